@@ -176,6 +176,8 @@ struct kdbus_bus *kdbus_bus_new(struct kdbus_domain *domain,
 	INIT_LIST_HEAD(&b->notify_list);
 	spin_lock_init(&b->notify_lock);
 	mutex_init(&b->notify_flush_lock);
+	INIT_DELAYED_WORK(&b->notify_work, kdbus_notify_flush_work);
+	b->notify_batch_end = jiffies;
 	atomic64_set(&b->conn_seq_last, 0);
 	b->domain = kdbus_domain_ref(domain);
 	kdbus_policy_db_init(&b->policy_db);
@@ -207,7 +209,7 @@ struct kdbus_bus *kdbus_bus_new(struct kdbus_domain *domain,
 				      KDBUS_ATTACH_CGROUP |
 				      KDBUS_ATTACH_CAPS |
 				      KDBUS_ATTACH_SECLABEL |
-				      KDBUS_ATTACH_AUDIT);
+				      KDBUS_ATTACH_AUDIT, b);
 	if (ret < 0)
 		goto exit_unref;
 
@@ -417,7 +419,7 @@ void kdbus_bus_broadcast(struct kdbus_bus *bus,
 			 */
 			if (!conn_src->faked_meta)
 				kdbus_meta_proc_collect(kmsg->proc_meta,
-							attach_flags);
+							attach_flags, bus);
 			kdbus_meta_conn_collect(kmsg->conn_meta, kmsg, conn_src,
 						attach_flags);
 		} else {
@@ -475,7 +477,7 @@ void kdbus_bus_eavesdrop(struct kdbus_bus *bus,
 								    conn_dst);
 			if (!conn_src->faked_meta)
 				kdbus_meta_proc_collect(kmsg->proc_meta,
-							attach_flags);
+							attach_flags, bus);
 			kdbus_meta_conn_collect(kmsg->conn_meta, kmsg, conn_src,
 						attach_flags);
 		}
@@ -519,7 +521,7 @@ int kdbus_cmd_bus_creator_info(struct kdbus_conn *conn,
 	attach_flags = cmd_info->flags & bus->attach_flags_owner;
 
 	meta_items = kdbus_meta_export(bus->creator_meta, NULL, attach_flags,
-				       &meta_size);
+				       &meta_size, bus);
 	if (IS_ERR(meta_items))
 		return PTR_ERR(meta_items);
 
@@ -18,11 +18,16 @@
 #include <linux/hashtable.h>
 #include <linux/spinlock.h>
 #include <linux/rwsem.h>
+#include <linux/workqueue.h>
 
 #include "node.h"
 #include "policy.h"
 #include "util.h"
 
+/* number of kernel notification types */
+#define KDBUS_BUS_NOTIFY_TYPES \
+	(KDBUS_ITEM_NAME_DELTA - _KDBUS_ITEM_KERNEL_BASE + 1)
+
 /**
  * struct kdbus_bus - bus in a domain
  * @node:		kdbus_node
@@ -44,6 +49,12 @@
  * @notify_list:	List of pending kernel-generated messages
  * @notify_lock:	Notification list lock
  * @notify_flush_lock:	Notification flushing lock
+ * @notify_work:	Deferred flush of @notify_list
+ * @notify_batch_end:	End of the batching window opened by the last
+ *			deferred flush, in jiffies
+ * @notify_subscribers:	Number of match entries that can match each type of
+ *			kernel notification, indexed from
+ *			_KDBUS_ITEM_KERNEL_BASE
  * @conn_rwlock:	Read/Write lock for all lists of child connections
  * @conn_hash:		Map of connection IDs
  * @monitors_list:	Connections that monitor this bus
@@ -74,6 +85,9 @@ struct kdbus_bus {
 	struct list_head notify_list;
 	spinlock_t notify_lock;
 	struct mutex notify_flush_lock;
+	struct delayed_work notify_work;
+	unsigned long notify_batch_end;
+	atomic_t notify_subscribers[KDBUS_BUS_NOTIFY_TYPES];
 
 	struct rw_semaphore conn_rwlock;
 	DECLARE_HASHTABLE(conn_hash, 8);
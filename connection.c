@@ -16,7 +16,9 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/fs_struct.h>
+#include <linux/hash.h>
 #include <linux/hashtable.h>
+#include <linux/hrtimer.h>
 #include <linux/idr.h>
 #include <linux/init.h>
 #include <linux/math64.h>
@@ -60,6 +62,8 @@ static int kdbus_conn_queue_user_quota(const struct kdbus_conn *conn_src,
 				       struct kdbus_conn *conn_dst,
 				       struct kdbus_queue_entry *entry)
 {
+	unsigned int max_msgs = conn_dst->max_msgs_per_user;
+	struct kdbus_conn_user *u = NULL;
 	struct kdbus_domain_user *user;
 
 	/*
@@ -75,35 +79,70 @@ static int kdbus_conn_queue_user_quota(const struct kdbus_conn *conn_src,
 	 * Per-user accounting can be expensive if we have many different
 	 * users on the bus. Allow one set of messages to pass through
 	 * un-accounted. Only once we hit that limit, we start accounting.
+	 *
+	 * Fair queues need to know the sender of every message, so they
+	 * account all of them, and extend the limit by the set of messages
+	 * that would have passed un-accounted.
 	 */
-	if (conn_dst->queue.msg_count < KDBUS_CONN_MAX_MSGS_UNACCOUNTED)
+	if (conn_dst->queue.fair)
+		max_msgs += KDBUS_CONN_MAX_MSGS_UNACCOUNTED;
+	else if (conn_dst->queue.msg_count < KDBUS_CONN_MAX_MSGS_UNACCOUNTED)
 		return 0;
 
 	user = conn_src->user;
 
-	/* extend array to store the user message counters */
-	if (user->idr >= conn_dst->msg_users_max) {
-		unsigned int *users;
-		unsigned int i;
+	hash_for_each_possible(conn_dst->msg_users, u, hentry, user->idr)
+		if (u->user == user)
+			break;
 
-		i = 8 + KDBUS_ALIGN8(user->idr);
-		users = krealloc(conn_dst->msg_users, i * sizeof(unsigned int),
-				 GFP_KERNEL | __GFP_ZERO);
-		if (!users)
+	if (!u) {
+		u = kmalloc(sizeof(*u), GFP_KERNEL);
+		if (!u)
 			return -ENOMEM;
 
-		conn_dst->msg_users = users;
-		conn_dst->msg_users_max = i;
+		u->user = kdbus_domain_user_ref(user);
+		u->msg_count = 0;
+		kdbus_queue_flow_init(&u->flow);
+		hash_add(conn_dst->msg_users, &u->hentry, user->idr);
+		conn_dst->msg_users_idle++;
 	}
 
-	if (conn_dst->msg_users[user->idr] >= KDBUS_CONN_MAX_MSGS_PER_USER)
+	if (u->msg_count >= max_msgs)
 		return -ENOBUFS;
 
-	conn_dst->msg_users[user->idr]++;
-	entry->user = kdbus_domain_user_ref(user);
+	if (u->msg_count++ == 0)
+		conn_dst->msg_users_idle--;
+
+	entry->user = u;
 	return 0;
 }
 
+/**
+ * kdbus_conn_user_uncharge() - account a dequeued message of a user
+ * @conn:		Connection the message was queued on
+ * @u:			Counter the message was accounted on
+ *
+ * Once @u has no messages left, it is kept for reuse, unless the connection
+ * already holds KDBUS_CONN_MAX_IDLE_USERS idle counters.
+ */
+void kdbus_conn_user_uncharge(struct kdbus_conn *conn,
+			      struct kdbus_conn_user *u)
+{
+	BUG_ON(u->msg_count == 0);
+
+	if (--u->msg_count > 0)
+		return;
+
+	if (conn->msg_users_idle < KDBUS_CONN_MAX_IDLE_USERS) {
+		conn->msg_users_idle++;
+		return;
+	}
+
+	hash_del(&u->hentry);
+	kdbus_domain_user_unref(u->user);
+	kfree(u);
+}
+
 /**
  * kdbus_cmd_msg_recv() - receive a message from the queue
  * @conn:		Connection to work on
@@ -122,7 +161,8 @@ int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
 	if (recv->msg.offset > 0)
 		return -EINVAL;
 
-	mutex_lock(&conn->lock);
+	mutex_lock(&conn->queue.lock);
+	kdbus_queue_splice(&conn->queue);
 	entry = kdbus_queue_entry_peek(&conn->queue, recv->priority,
 				       recv->flags & KDBUS_RECV_USE_PRIORITY);
 	if (IS_ERR(entry)) {
@@ -147,7 +187,7 @@ int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
 		kdbus_queue_entry_remove(conn, entry);
 		kdbus_pool_slice_release(entry->slice);
 
-		mutex_unlock(&conn->lock);
+		mutex_unlock(&conn->queue.lock);
 
 		if (reply) {
 			/*
@@ -168,7 +208,7 @@ int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
 			mutex_unlock(&reply->reply_dst->lock);
 		}
 
-		kdbus_notify_flush(conn->ep->bus);
+		kdbus_notify_flush_deferred(conn->ep->bus);
 		kdbus_queue_entry_free(entry);
 		kdbus_reply_unref(reply);
 
@@ -215,8 +255,8 @@ int kdbus_cmd_msg_recv(struct kdbus_conn *conn,
 	}
 
 exit_unlock:
-	mutex_unlock(&conn->lock);
-	kdbus_notify_flush(conn->ep->bus);
+	mutex_unlock(&conn->queue.lock);
+	kdbus_notify_flush_deferred(conn->ep->bus);
 	return ret;
 }
 
@@ -262,7 +302,10 @@ static int kdbus_conn_check_access(struct kdbus_conn *conn_src,
 	return 0;
 }
 
-/* Callers should take the conn_dst lock */
+/*
+ * Callers should take the conn_dst queue lock, or else check again whether
+ * the connection is active once they hold it.
+ */
 static struct kdbus_queue_entry *
 kdbus_conn_entry_make(struct kdbus_conn *conn_dst,
 		      const struct kdbus_kmsg *kmsg)
@@ -336,6 +379,17 @@ static int kdbus_conn_entry_sync_attach(struct kdbus_conn *conn_dst,
 	return ret;
 }
 
+/*
+ * Wake up poll() after a message was queued. Connections that coalesce
+ * wakeups are only woken when their queue was empty; as long as messages
+ * are queued, they keep receiving until they get -EAGAIN anyway.
+ */
+static void kdbus_conn_wake_receiver(struct kdbus_conn *conn, bool first)
+{
+	if (first || !(conn->flags & KDBUS_HELLO_COALESCE_WAKEUP))
+		wake_up_interruptible(&conn->wait);
+}
+
 /**
  * kdbus_conn_entry_insert() - enqueue a message into the receiver's pool
  * @conn_src:		The sending connection
@@ -350,10 +404,58 @@ int kdbus_conn_entry_insert(struct kdbus_conn *conn_src,
 			    const struct kdbus_kmsg *kmsg,
 			    struct kdbus_reply *reply)
 {
-	struct kdbus_queue_entry *entry;
+	struct kdbus_queue_entry *entry = NULL;
+	bool first;
 	int ret;
 
-	kdbus_conn_lock2(conn_src, conn_dst);
+	/*
+	 * As long as a queue is short enough that messages are not accounted
+	 * on their sender, messages without reply tracker are pushed without
+	 * taking any lock. The receiver splices them into its queue once it
+	 * takes the queue lock.
+	 */
+	if (!reply && !conn_dst->queue.fair) {
+		entry = kdbus_conn_entry_make(conn_dst, kmsg);
+		if (IS_ERR(entry))
+			return PTR_ERR(entry);
+
+		if (kdbus_queue_entry_push(&conn_dst->queue, entry,
+				min_t(size_t, conn_dst->max_msgs,
+				      KDBUS_CONN_MAX_MSGS_UNACCOUNTED),
+				&first)) {
+			/*
+			 * Disconnecting sets the bias before it looks for
+			 * pending messages, so it either sees this one, or we
+			 * see the bias now. In the latter case, the queue
+			 * lock is held until the disconnect either went
+			 * through, and the message is dropped with the queue,
+			 * or failed with -EBUSY and reverted the bias.
+			 */
+			if (unlikely(!kdbus_conn_active(conn_dst))) {
+				mutex_lock(&conn_dst->queue.lock);
+				ret = kdbus_conn_active(conn_dst) ?
+				      0 : -ECONNRESET;
+				mutex_unlock(&conn_dst->queue.lock);
+				if (ret < 0)
+					return ret;
+			}
+
+			kdbus_conn_wake_receiver(conn_dst, first);
+			return 0;
+		}
+	}
+
+	/*
+	 * Only the reply tracker is linked to the sender, the queue of the
+	 * receiver has its own lock. Senders without reply tracker thus do
+	 * not contend with anything but other senders and the receiver.
+	 */
+	if (reply)
+		mutex_lock(&conn_src->lock);
+	mutex_lock(&conn_dst->queue.lock);
+
+	/* keep the order with messages pushed before */
+	kdbus_queue_splice(&conn_dst->queue);
 
 	/*
 	 * Limit the maximum number of queued messages. This applies
@@ -362,18 +464,23 @@ int kdbus_conn_entry_insert(struct kdbus_conn *conn_src,
 	 * The kernel sends notifications to subscribed connections
 	 * only. If the connection do not clean its queue, no further
 	 * message delivery.
-	 * Kernel is able to queue KDBUS_CONN_MAX_MSGS messages, this
-	 * includes all type of notifications.
+	 * Kernel is able to queue max_msgs messages, this includes all
+	 * type of notifications.
 	 */
-	if (conn_dst->queue.msg_count >= KDBUS_CONN_MAX_MSGS) {
+	if (conn_dst->queue.msg_count >= conn_dst->max_msgs) {
 		ret = -ENOBUFS;
-		goto exit_unlock;
+		goto exit_queue_free;
 	}
 
-	entry = kdbus_conn_entry_make(conn_dst, kmsg);
-	if (IS_ERR(entry)) {
-		ret = PTR_ERR(entry);
-		goto exit_unlock;
+	if (!entry) {
+		entry = kdbus_conn_entry_make(conn_dst, kmsg);
+		if (IS_ERR(entry)) {
+			ret = PTR_ERR(entry);
+			goto exit_unlock;
+		}
+	} else if (!kdbus_conn_active(conn_dst)) {
+		ret = -ECONNRESET;
+		goto exit_queue_free;
 	}
 
 	/* limit the number of queued messages from the same individual user */
@@ -388,62 +495,200 @@ int kdbus_conn_entry_insert(struct kdbus_conn *conn_src,
 	 */
 	entry->reply = kdbus_reply_ref(reply);
 
-	if (reply) {
+	if (reply)
 		kdbus_reply_link(reply);
-		if (!reply->sync)
-			schedule_delayed_work(&conn_src->work, 0);
-	}
 
 	/* link the message into the receiver's entry */
+	first = conn_dst->queue.msg_count == 0;
 	kdbus_queue_entry_add(&conn_dst->queue, entry);
 
-	/* wake up poll() */
-	wake_up_interruptible(&conn_dst->wait);
+	kdbus_conn_wake_receiver(conn_dst, first);
 
 	ret = 0;
 	goto exit_unlock;
 
 exit_queue_free:
-	kdbus_queue_entry_free(entry);
+	if (entry) {
+		kdbus_pool_slice_release(entry->slice_vecs);
+		kdbus_queue_entry_free(entry);
+	}
 exit_unlock:
-	kdbus_conn_unlock2(conn_src, conn_dst);
+	mutex_unlock(&conn_dst->queue.lock);
+	if (reply)
+		mutex_unlock(&conn_src->lock);
 	return ret;
 }
 
 /**
- * kdbus_conn_wait_reply() - Wait for the reply of a synchronous send
- *			     operation
- * @conn_src:		The sending connection (origin)
- * @conn_dst:		The replying connection
- * @cmd_send:		Payload of SEND command
- * @ioctl_file:		struct file used to issue this ioctl
- * @cancel_fd:		Pinned file that reflects KDBUS_ITEM_CANCEL_FD
- *			item, used to cancel the blocking send call
- * @reply_wait:		The tracked reply that we are waiting for.
- * @expire:		Reply timeout
+ * kdbus_conn_space_released() - wake senders waiting for room in a queue
+ * @conn:		Connection that dequeued a message or released a slice
+ *			of its pool
  *
- * Return: 0 on success. negative error otherwise.
+ * Senders blocking in KDBUS_CMD_SEND are woken up, and senders that poll for
+ * @conn to become writable get POLLOUT signalled on their own connection.
+ * They forget about @conn, so they no longer pin it. The caller must hold a
+ * reference to @conn.
  */
-static int kdbus_conn_wait_reply(struct kdbus_conn *conn_src,
-				 struct kdbus_conn *conn_dst,
-				 struct kdbus_cmd_send *cmd_send,
-				 struct file *ioctl_file,
-				 struct file *cancel_fd,
-				 struct kdbus_reply *reply_wait,
-				 ktime_t expire)
+void kdbus_conn_space_released(struct kdbus_conn *conn)
 {
-	struct kdbus_queue_entry *entry;
-	struct poll_wqueues pwq = {};
-	int ret;
+	struct kdbus_conn *c, *tmp;
+	unsigned int n = 0;
+
+	atomic_inc(&conn->space_seq);
+
+	/* pairs with the barrier in set_current_state() of the waiter */
+	smp_mb__after_atomic();
+	if (waitqueue_active(&conn->space_wait))
+		wake_up_interruptible(&conn->space_wait);
+
+	spin_lock(&conn->space_lock);
+	list_for_each_entry_safe(c, tmp, &conn->space_waiters, space_entry) {
+		list_del_init(&c->space_entry);
+		ACCESS_ONCE(c->space_dst) = NULL;
+		wake_up_interruptible_poll(&c->wait, POLLOUT | POLLWRNORM);
+		n++;
+	}
+	spin_unlock(&conn->space_lock);
 
-	if (WARN_ON(!reply_wait))
-		return -EIO;
+	/* drop the references the waiters held */
+	while (n--)
+		kdbus_conn_unref(conn);
+}
+
+/*
+ * Remove @conn from the waiters of its destination, and return the
+ * destination. The caller must hold @conn->lock, and has to drop the
+ * reference to the destination returned.
+ */
+static struct kdbus_conn *kdbus_conn_space_unlink(struct kdbus_conn *conn)
+{
+	struct kdbus_conn *dst, *ret = NULL;
+
+	/* connections are freed after a grace period */
+	rcu_read_lock();
+	dst = ACCESS_ONCE(conn->space_dst);
+	if (dst) {
+		spin_lock(&dst->space_lock);
+		/* unless kdbus_conn_space_released() raced with us */
+		if (conn->space_dst == dst) {
+			list_del_init(&conn->space_entry);
+			conn->space_dst = NULL;
+			ret = dst;
+		}
+		spin_unlock(&dst->space_lock);
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * Mark @conn_src as not writable until @conn_dst releases space. If space was
+ * released since @space_seq was sampled, @conn_src stays writable.
+ */
+static void kdbus_conn_space_block(struct kdbus_conn *conn_src,
+				   struct kdbus_conn *conn_dst,
+				   unsigned int space_seq)
+{
+	struct kdbus_conn *old;
+
+	mutex_lock(&conn_src->lock);
+	old = kdbus_conn_space_unlink(conn_src);
 
 	/*
-	 * Block until the reply arrives. reply_wait is left untouched
-	 * by the timeout scans that might be conducted for other,
-	 * asynchronous replies of conn_src.
+	 * Disconnecting @conn_dst releases its waiters after deactivating it,
+	 * under the same lock, so no waiter can be left behind.
 	 */
+	spin_lock(&conn_dst->space_lock);
+	if (atomic_read(&conn_dst->space_seq) == space_seq &&
+	    kdbus_conn_active(conn_dst)) {
+		list_add_tail(&conn_src->space_entry,
+			      &conn_dst->space_waiters);
+		conn_src->space_dst = kdbus_conn_ref(conn_dst);
+	}
+	spin_unlock(&conn_dst->space_lock);
+	mutex_unlock(&conn_src->lock);
+
+	kdbus_conn_unref(old);
+}
+
+/* Make @conn writable again, and forget about its former destination. */
+static void kdbus_conn_space_unblock(struct kdbus_conn *conn)
+{
+	struct kdbus_conn *old;
+
+	mutex_lock(&conn->lock);
+	old = kdbus_conn_space_unlink(conn);
+	mutex_unlock(&conn->lock);
+
+	kdbus_conn_unref(old);
+}
+
+/*
+ * Wait until @conn_dst released queue or pool space since @space_seq was
+ * sampled. A zero @expire waits until interrupted. We sleep on the wait
+ * queue of @conn_src, too: a BYEBYE issued by another thread does not wait
+ * for our active reference (see kdbus_conn_wait_reply_poll()) and needs to
+ * kick us out of here.
+ */
+static int kdbus_conn_wait_space(struct kdbus_conn *conn_src,
+				 struct kdbus_conn *conn_dst,
+				 unsigned int space_seq, ktime_t expire)
+{
+	wait_queue_t wait_src, wait_dst;
+	int ret;
+
+	init_waitqueue_entry(&wait_src, current);
+	init_waitqueue_entry(&wait_dst, current);
+	add_wait_queue(&conn_src->wait, &wait_src);
+	add_wait_queue(&conn_dst->space_wait, &wait_dst);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		if (!kdbus_conn_active(conn_src) ||
+		    !kdbus_conn_active(conn_dst)) {
+			ret = -ECONNRESET;
+			break;
+		}
+
+		if (atomic_read(&conn_dst->space_seq) != space_seq) {
+			ret = 0;
+			break;
+		}
+
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		if (!schedule_hrtimeout(ktime_to_ns(expire) > 0 ? &expire : NULL,
+					HRTIMER_MODE_ABS)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+
+	__set_current_state(TASK_RUNNING);
+	remove_wait_queue(&conn_dst->space_wait, &wait_dst);
+	remove_wait_queue(&conn_src->wait, &wait_src);
+
+	return ret;
+}
+
+/*
+ * Wait for a reply while also polling the cancel fd of the sender. Wake-ups
+ * are received through the wait queue of @conn_src.
+ */
+static int kdbus_conn_wait_reply_poll(struct kdbus_conn *conn_src,
+				      struct file *ioctl_file,
+				      struct file *cancel_fd,
+				      struct kdbus_reply *reply_wait,
+				      ktime_t expire)
+{
+	struct poll_wqueues pwq = {};
+	unsigned int r;
+	int ret;
 
 	poll_initwait(&pwq);
 	poll_wait(ioctl_file, &conn_src->wait, &pwq.pt);
@@ -478,18 +723,15 @@ static int kdbus_conn_wait_reply(struct kdbus_conn *conn_src,
 		 * it will wake up us.
 		 */
 		if (!reply_wait->waiting) {
+			smp_rmb();
 			ret = reply_wait->err;
 			break;
 		}
 
-		if (cancel_fd) {
-			unsigned int r;
-
-			r = cancel_fd->f_op->poll(cancel_fd, &pwq.pt);
-			if (r & POLLIN) {
-				ret = -ECANCELED;
-				break;
-			}
+		r = cancel_fd->f_op->poll(cancel_fd, &pwq.pt);
+		if (r & POLLIN) {
+			ret = -ECANCELED;
+			break;
 		}
 
 		if (signal_pending(current)) {
@@ -513,6 +755,125 @@ static int kdbus_conn_wait_reply(struct kdbus_conn *conn_src,
 
 	poll_freewait(&pwq);
 
+	return ret;
+}
+
+/*
+ * Wait for a reply without a cancel fd. The waiting task is recorded in
+ * @reply_wait, so the replying peer wakes exactly this task, instead of
+ * everyone waiting on the connection.
+ */
+static int kdbus_conn_wait_reply_direct(struct kdbus_conn *conn_src,
+					struct kdbus_reply *reply_wait,
+					ktime_t expire)
+{
+	int ret;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		/* see kdbus_conn_wait_reply_poll() */
+		if (!kdbus_conn_active(conn_src)) {
+			ret = -ECONNRESET;
+			break;
+		}
+
+		if (!reply_wait->waiting) {
+			smp_rmb();
+			ret = reply_wait->err;
+			break;
+		}
+
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		if (!schedule_hrtimeout(&expire, HRTIMER_MODE_ABS)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+
+	__set_current_state(TASK_RUNNING);
+
+	return ret;
+}
+
+/*
+ * Spin for at most @busy_poll_ns, waiting for the reply to arrive without
+ * scheduling out. Gives up early if anything else wants the CPU, or any
+ * condition is met that the sleeping wait handles.
+ */
+static void kdbus_conn_busy_poll_reply(struct kdbus_conn *conn_src,
+				       struct kdbus_reply *reply_wait,
+				       u64 busy_poll_ns)
+{
+	u64 end = ktime_get_ns() + busy_poll_ns;
+
+	while (reply_wait->waiting) {
+		if (need_resched() || signal_pending(current) ||
+		    !kdbus_conn_active(conn_src))
+			break;
+
+		if (ktime_get_ns() >= end)
+			break;
+
+		cpu_relax();
+	}
+}
+
+/**
+ * kdbus_conn_wait_reply() - Wait for the reply of a synchronous send
+ *			     operation
+ * @conn_src:		The sending connection (origin)
+ * @conn_dst:		The replying connection
+ * @cmd_send:		Payload of SEND command
+ * @ioctl_file:		struct file used to issue this ioctl
+ * @cancel_fd:		Pinned file that reflects KDBUS_ITEM_CANCEL_FD
+ *			item, used to cancel the blocking send call
+ * @reply_wait:		The tracked reply that we are waiting for.
+ * @expire:		Reply timeout
+ * @busy_poll_ns:	Time to busy-poll for the reply before sleeping
+ *
+ * Return: 0 on success. negative error otherwise.
+ */
+static int kdbus_conn_wait_reply(struct kdbus_conn *conn_src,
+				 struct kdbus_conn *conn_dst,
+				 struct kdbus_cmd_send *cmd_send,
+				 struct file *ioctl_file,
+				 struct file *cancel_fd,
+				 struct kdbus_reply *reply_wait,
+				 ktime_t expire,
+				 u64 busy_poll_ns)
+{
+	struct kdbus_queue_entry *entry;
+	int ret;
+
+	if (WARN_ON(!reply_wait))
+		return -EIO;
+
+	/*
+	 * Block until the reply arrives. reply_wait is left untouched
+	 * by the timeout scans that might be conducted for other,
+	 * asynchronous replies of conn_src.
+	 */
+	if (busy_poll_ns > 0)
+		kdbus_conn_busy_poll_reply(conn_src, reply_wait, busy_poll_ns);
+
+	if (cancel_fd) {
+		ret = kdbus_conn_wait_reply_poll(conn_src, ioctl_file,
+						 cancel_fd, reply_wait,
+						 expire);
+	} else {
+		mutex_lock(&conn_src->lock);
+		reply_wait->waiter = current;
+		mutex_unlock(&conn_src->lock);
+
+		ret = kdbus_conn_wait_reply_direct(conn_src, reply_wait,
+						   expire);
+	}
+
 	if (ret == -EINTR) {
 		/*
 		 * Interrupted system call. Unref the reply object, and pass
@@ -522,14 +883,16 @@ static int kdbus_conn_wait_reply(struct kdbus_conn *conn_src,
 		 * pick it up and wait on it again.
 		 */
 		mutex_lock(&conn_src->lock);
+		reply_wait->waiter = NULL;
 		reply_wait->interrupted = true;
-		schedule_delayed_work(&conn_src->work, 0);
+		kdbus_reply_arm(reply_wait);
 		mutex_unlock(&conn_src->lock);
 
 		return -ERESTARTSYS;
 	}
 
 	mutex_lock(&conn_src->lock);
+	reply_wait->waiter = NULL;
 	reply_wait->waiting = false;
 	entry = reply_wait->queue_entry;
 	if (entry) {
@@ -570,7 +933,12 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 	struct kdbus_bus *bus = conn_src->ep->bus;
 	struct file *cancel_fd = NULL;
 	struct kdbus_item *item;
-	int ret = 0;
+	bool wait_space = false;
+	bool activator;
+	ktime_t space_expire = ktime_set(0, 0);
+	unsigned int space_seq;
+	u64 busy_poll_ns = 0;
+	int ret = 0, err;
 
 	/* assign domain-global message sequence number */
 	if (WARN_ON(kmsg->seq > 0))
@@ -598,6 +966,18 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 			}
 			break;
 
+		case KDBUS_ITEM_BUSY_POLL:
+			/* only used for synchronous sends */
+			busy_poll_ns = min_t(u64, item->data64[0],
+					     KDBUS_SYNC_BUSY_POLL_MAX_NS);
+			break;
+
+		case KDBUS_ITEM_SEND_TIMEOUT:
+			/* wait for room in the destination's queue */
+			wait_space = true;
+			space_expire = ns_to_ktime(item->data64[0]);
+			break;
+
 		default:
 			ret = -EINVAL;
 			goto exit_put_cancelfd;
@@ -613,19 +993,51 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 
 	if (kmsg->res && kmsg->res->dst_name) {
 		/*
-		 * Lock the destination name so it will not get dropped or
-		 * moved between activator/implementer while we try to queue a
-		 * message. We also rely on this to read-lock the entire
-		 * registry so kdbus_meta_conn_collect() will have a consistent
-		 * view of all acquired names on both connections.
-		 * If kdbus_name_lock() gets changed to a per-name lock, we
-		 * really need to read-lock the whole registry here.
+		 * Resolve the destination name without taking the registry
+		 * lock. This is only done for names without an activator: if
+		 * such a name changes owner while the message is in flight,
+		 * it is queued on the former owner, which the new owner
+		 * cannot tell apart from the message having been sent before
+		 * the change. The sender's names are collected under its own
+		 * lock, so kdbus_meta_conn_collect() still sees a consistent
+		 * view.
+		 *
+		 * The name_id is recorded in the kmsg and passed on to the
+		 * queue, in case messages addressed to a name need to be
+		 * moved from or to activator connections of the same name.
 		 */
-		name_entry = kdbus_name_lock(bus->name_registry,
-					     kmsg->res->dst_name);
-		if (!name_entry) {
-			ret = -ESRCH;
-			goto exit_put_cancelfd;
+		conn_dst = kdbus_name_resolve(bus->name_registry,
+					      &conn_src->name_cache,
+					      kmsg->res->dst_name,
+					      &kmsg->dst_name_id, &activator);
+
+		/*
+		 * Messages queued on the activator of a name are moved to the
+		 * implementer when it takes over the name, and messages still
+		 * queued on the implementer are moved back to the activator
+		 * when it releases the name. Lock the name, so it does not
+		 * change hands between activator and implementer while we
+		 * queue the message; a message queued on the implementer
+		 * right after the move would be left behind. This is also
+		 * the fallback if the lockless lookup raced with an
+		 * ownership change.
+		 */
+		if (!conn_dst || activator) {
+			conn_dst = kdbus_conn_unref(conn_dst);
+
+			name_entry = kdbus_name_lock(bus->name_registry,
+						     kmsg->res->dst_name);
+			if (!name_entry) {
+				ret = -ESRCH;
+				goto exit_put_cancelfd;
+			}
+
+			conn_dst = name_entry->conn;
+			if (!conn_dst)
+				conn_dst = name_entry->activator;
+			conn_dst = kdbus_conn_ref(conn_dst);
+
+			kmsg->dst_name_id = name_entry->name_id;
 		}
 
 		/*
@@ -637,16 +1049,11 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 		 * owns the given name.
 		 */
 		if (msg->dst_id != KDBUS_DST_ID_NAME &&
-		    msg->dst_id != name_entry->conn->id) {
+		    msg->dst_id != conn_dst->id) {
 			ret = -EREMCHG;
-			goto exit_name_unlock;
+			goto exit_unref;
 		}
 
-		if (!name_entry->conn && name_entry->activator)
-			conn_dst = kdbus_conn_ref(name_entry->activator);
-		else
-			conn_dst = kdbus_conn_ref(name_entry->conn);
-
 		if ((msg->flags & KDBUS_MSG_NO_AUTO_START) &&
 		    kdbus_conn_is_activator(conn_dst)) {
 			ret = -EADDRNOTAVAIL;
@@ -668,15 +1075,6 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 		}
 	}
 
-	/*
-	 * Record the sequence number of the registered name;
-	 * it will be passed on to the queue, in case messages
-	 * addressed to a name need to be moved from or to
-	 * activator connections of the same name.
-	 */
-	if (name_entry)
-		kmsg->dst_name_id = name_entry->name_id;
-
 	if (conn_src) {
 		u64 attach_flags;
 
@@ -699,6 +1097,7 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 				if (reply_wait->interrupted) {
 					kdbus_reply_ref(reply_wait);
 					reply_wait->interrupted = false;
+					kdbus_reply_disarm(reply_wait);
 				} else {
 					reply_wait = NULL;
 				}
@@ -719,7 +1118,7 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 		 */
 		if (!conn_src->faked_meta) {
 			ret = kdbus_meta_proc_collect(kmsg->proc_meta,
-						      attach_flags);
+						      attach_flags, bus);
 			if (ret < 0)
 				goto exit_unref;
 		}
@@ -740,7 +1139,7 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 				goto exit_unref;
 
 			reply_wait = kdbus_reply_new(conn_dst, conn_src, msg,
-						     name_entry, sync);
+						     kmsg->dst_name_id, sync);
 			if (IS_ERR(reply_wait)) {
 				ret = PTR_ERR(reply_wait);
 				reply_wait = NULL;
@@ -793,11 +1192,45 @@ int kdbus_cmd_msg_send(struct kdbus_conn *conn_src,
 		/*
 		 * Otherwise, put it in the queue and wait for the connection
 		 * to dequeue and receive the message.
+		 *
+		 * If requested, a full queue or pool makes the sender wait
+		 * for the receiver to release space, instead of failing. This
+		 * is not done while a name is locked for an activator, as
+		 * that would stall the name's handover to the implementer.
 		 */
-		ret = kdbus_conn_entry_insert(conn_src, conn_dst,
-					      kmsg, reply_wait);
+		for (;;) {
+			space_seq = atomic_read(&conn_dst->space_seq);
+
+			ret = kdbus_conn_entry_insert(conn_src, conn_dst,
+						      kmsg, reply_wait);
+			if (ret != -ENOBUFS && ret != -EXFULL)
+				break;
+
+			if (!wait_space || name_entry) {
+				/* let poll() wait for conn_dst to drain */
+				kdbus_conn_space_block(conn_src, conn_dst,
+						       space_seq);
+				break;
+			}
+
+			/* on timeout, report why the message was not queued */
+			err = kdbus_conn_wait_space(conn_src, conn_dst, space_seq,
+						    space_expire);
+			if (err == -ETIMEDOUT)
+				break;
+
+			if (err < 0) {
+				ret = err;
+				break;
+			}
+		}
+
 		if (ret < 0)
 			goto exit_unref;
+
+		/* queuing succeeded, the former destination has room again */
+		if (unlikely(ACCESS_ONCE(conn_src->space_dst) == conn_dst))
+			kdbus_conn_space_unblock(conn_src);
 	}
 
 wait_sync:
@@ -811,7 +1244,8 @@ wait_sync:
 		if (likely(ktime_compare(now, expire) < 0))
 			ret = kdbus_conn_wait_reply(conn_src, conn_dst, cmd,
 						    ioctl_file, cancel_fd,
-						    reply_wait, expire);
+						    reply_wait, expire,
+						    busy_poll_ns);
 		else
 			ret = -ETIMEDOUT;
 	}
@@ -820,7 +1254,6 @@ exit_unref:
 	kdbus_reply_unref(reply_wait);
 	kdbus_reply_unref(reply_wake);
 	kdbus_conn_unref(conn_dst);
-exit_name_unlock:
 	kdbus_name_unlock(bus->name_registry, name_entry);
 exit_put_cancelfd:
 	if (cancel_fd)
@@ -861,16 +1294,39 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 		mutex_unlock(&conn->lock);
 		return -EALREADY;
 	}
-	if (ensure_queue_empty && !list_empty(&conn->queue.msg_list)) {
+
+	/*
+	 * Senders check for the bias with the queue lock held, or right
+	 * after pushing a message without it. So set the bias before looking
+	 * for pending messages; a pusher either sees the bias, or we see its
+	 * message. See kdbus_conn_entry_insert().
+	 */
+	mutex_lock(&conn->queue.lock);
+	atomic_add(KDBUS_CONN_ACTIVE_BIAS, &conn->active);
+	smp_mb__after_atomic();
+
+	kdbus_queue_splice(&conn->queue);
+	if (ensure_queue_empty &&
+	    (!list_empty(&conn->queue.msg_list) ||
+	     atomic_read(&conn->queue.msg_pending_count) > 0)) {
 		/* still busy */
+		atomic_sub(KDBUS_CONN_ACTIVE_BIAS, &conn->active);
+		mutex_unlock(&conn->queue.lock);
 		mutex_unlock(&conn->lock);
 		return -EBUSY;
 	}
 
-	atomic_add(KDBUS_CONN_ACTIVE_BIAS, &conn->active);
+	mutex_unlock(&conn->queue.lock);
+
+	/* synchronous senders in the direct path don't sleep on conn->wait */
+	list_for_each_entry(r, &conn->reply_list, entry)
+		if (r->waiter)
+			wake_up_process(r->waiter);
 	mutex_unlock(&conn->lock);
 
 	wake_up_interruptible(&conn->wait);
+	kdbus_conn_space_released(conn);
+	kdbus_conn_space_unblock(conn);
 
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
 	rwsem_acquire(&conn->dep_map, 0, 0, _RET_IP_);
@@ -907,8 +1363,13 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 	 */
 	kdbus_name_remove_by_conn(bus->name_registry, conn);
 
-	/* if we die while other connections wait for our reply, notify them */
+	/*
+	 * If we die while other connections wait for our reply, notify them.
+	 * Lock order: conn -> queue
+	 */
 	mutex_lock(&conn->lock);
+	mutex_lock(&conn->queue.lock);
+	kdbus_queue_splice(&conn->queue);
 	list_for_each_entry_safe(entry, tmp, &conn->queue.msg_list, entry) {
 		if (entry->reply)
 			kdbus_notify_reply_dead(bus, entry->msg.src_id,
@@ -918,6 +1379,7 @@ int kdbus_conn_disconnect(struct kdbus_conn *conn, bool ensure_queue_empty)
 		kdbus_pool_slice_release(entry->slice);
 		kdbus_queue_entry_free(entry);
 	}
+	mutex_unlock(&conn->queue.lock);
 
 	list_for_each_entry_safe(r, r_tmp, &conn->reply_list, entry)
 		kdbus_reply_unlink(r);
@@ -972,6 +1434,10 @@ bool kdbus_conn_active(const struct kdbus_conn *conn)
 static void __kdbus_conn_free(struct kref *kref)
 {
 	struct kdbus_conn *conn = container_of(kref, struct kdbus_conn, kref);
+	struct kdbus_queue_entry *entry, *entry_tmp;
+	struct kdbus_conn_user *u;
+	struct hlist_node *tmp;
+	unsigned int i;
 
 	WARN_ON(kdbus_conn_active(conn));
 	WARN_ON(delayed_work_pending(&conn->work));
@@ -980,18 +1446,36 @@ static void __kdbus_conn_free(struct kref *kref)
 	WARN_ON(!list_empty(&conn->names_queue_list));
 	WARN_ON(!list_empty(&conn->reply_list));
 
+	/* messages pushed while the connection was being disconnected */
+	llist_for_each_entry_safe(entry, entry_tmp,
+				  llist_del_all(&conn->queue.msg_pending),
+				  pending_node) {
+		kdbus_pool_slice_release(entry->slice_vecs);
+		kdbus_queue_entry_free(entry);
+	}
+
 	if (conn->user) {
 		atomic_dec(&conn->user->connections);
 		kdbus_domain_user_unref(conn->user);
 	}
 
+	hash_for_each_safe(conn->msg_users, i, tmp, u, hentry) {
+		WARN_ON(u->msg_count > 0);
+		hash_del(&u->hentry);
+		kdbus_domain_user_unref(u->user);
+		kfree(u);
+	}
+
+	kdbus_name_cache_clear(&conn->name_cache);
 	kdbus_meta_proc_unref(conn->meta);
 	kdbus_match_db_free(conn->match_db);
 	kdbus_pool_free(conn->pool);
 	kdbus_ep_unref(conn->ep);
 	put_cred(conn->cred);
 	kfree(conn->description);
-	kfree(conn);
+
+	/* kdbus_name_resolve() might still try to take a reference */
+	kfree_rcu(conn, rcu);
 }
 
 /**
@@ -1131,14 +1615,20 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 			if (name_id > 0 && r->name_id != name_id)
 				continue;
 
-			kdbus_conn_unref(r->reply_src);
-			r->reply_src = kdbus_conn_ref(conn_dst);
+			kdbus_reply_move_src(r, conn_dst);
 		}
 		mutex_unlock(&c->lock);
 	}
 	up_read(&bus->conn_rwlock);
 
-	kdbus_conn_lock2(conn_src, conn_dst);
+	/*
+	 * Moves are serialized by the bus lock, so the queue locks of two
+	 * connections are never taken in opposite order.
+	 */
+	mutex_lock(&conn_src->queue.lock);
+	mutex_lock_nested(&conn_dst->queue.lock, SINGLE_DEPTH_NESTING);
+	kdbus_queue_splice(&conn_src->queue);
+	kdbus_queue_splice(&conn_dst->queue);
 	list_for_each_entry_safe(q, q_tmp, &conn_src->queue.msg_list, entry) {
 		/* filter messages for a specific name */
 		if (name_id > 0 && q->dst_name_id != name_id)
@@ -1158,7 +1648,8 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 			kdbus_queue_entry_free(q);
 		}
 	}
-	kdbus_conn_unlock2(conn_src, conn_dst);
+	mutex_unlock(&conn_dst->queue.lock);
+	mutex_unlock(&conn_src->queue.lock);
 
 	/* wake up poll() */
 	wake_up_interruptible(&conn_dst->wait);
@@ -1240,7 +1731,7 @@ int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 		goto exit;
 
 	meta_items = kdbus_meta_export(owner_conn->meta, conn_meta,
-				       attach_flags, &meta_size);
+				       attach_flags, &meta_size, conn->ep->bus);
 	if (IS_ERR(meta_items)) {
 		ret = PTR_ERR(meta_items);
 		meta_items = NULL;
@@ -1397,6 +1888,7 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 	struct kdbus_conn *conn;
 	u64 attach_flags_send;
 	u64 attach_flags_recv;
+	unsigned int max_msgs = KDBUS_CONN_MAX_MSGS;
 	bool is_policy_holder;
 	bool is_activator;
 	bool is_monitor;
@@ -1480,6 +1972,20 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 			conn_description = item->str;
 			break;
 
+		case KDBUS_ITEM_QUEUE_DEPTH:
+			/*
+			 * Every queued message occupies at least its header
+			 * in the pool, so deeper queues could never fill up.
+			 */
+			if (item->data64[0] == 0 ||
+			    item->data64[0] > KDBUS_CONN_MAX_MSGS_LIMIT ||
+			    item->data64[0] >
+			    div_u64(hello->pool_size, sizeof(struct kdbus_msg)))
+				return ERR_PTR(-EINVAL);
+
+			max_msgs = item->data64[0];
+			break;
+
 		case KDBUS_ITEM_POLICY_ACCESS:
 		case KDBUS_ITEM_BLOOM_MASK:
 		case KDBUS_ITEM_ID:
@@ -1488,6 +1994,7 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 		case KDBUS_ITEM_NAME_CHANGE:
 		case KDBUS_ITEM_ID_ADD:
 		case KDBUS_ITEM_ID_REMOVE:
+		case KDBUS_ITEM_NAME_DELTA:
 			/* will be handled by policy and match code */
 			break;
 
@@ -1529,16 +2036,33 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 	lockdep_init_map(&conn->dep_map, "s_active", &__key, 0);
 #endif
 	mutex_init(&conn->lock);
+	hash_init(conn->msg_users);
 	INIT_LIST_HEAD(&conn->names_list);
 	INIT_LIST_HEAD(&conn->names_queue_list);
 	INIT_LIST_HEAD(&conn->reply_list);
+	hash_init(conn->reply_hash);
+	conn->reply_deadlines = RB_ROOT;
+	kdbus_name_cache_init(&conn->name_cache);
+	spin_lock_init(&conn->policy_cache.lock);
 	atomic_set(&conn->name_count, 0);
+	atomic_set(&conn->names_generation, 0);
 	atomic_set(&conn->request_count, 0);
 	atomic_set(&conn->lost_count, 0);
 	INIT_DELAYED_WORK(&conn->work, kdbus_reply_list_scan_work);
 	conn->cred = get_current_cred();
+	kdbus_policy_creds_init(&conn->policy_creds, conn->cred);
 	init_waitqueue_head(&conn->wait);
-	kdbus_queue_init(&conn->queue);
+	init_waitqueue_head(&conn->space_wait);
+	atomic_set(&conn->space_seq, 0);
+	spin_lock_init(&conn->space_lock);
+	INIT_LIST_HEAD(&conn->space_waiters);
+	INIT_LIST_HEAD(&conn->space_entry);
+	kdbus_queue_init(&conn->queue, hello->flags & KDBUS_HELLO_FAIR_QUEUE);
+	conn->max_msgs = max_msgs;
+	conn->max_msgs_per_user = max_t(unsigned int,
+					KDBUS_CONN_MAX_MSGS_PER_USER,
+					max_msgs / (KDBUS_CONN_MAX_MSGS /
+						    KDBUS_CONN_MAX_MSGS_PER_USER));
 	conn->privileged = privileged;
 	conn->ep = kdbus_ep_ref(ep);
 	conn->id = atomic64_inc_return(&bus->conn_seq_last);
@@ -1563,7 +2087,7 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 		goto exit_unref;
 	}
 
-	conn->match_db = kdbus_match_db_new();
+	conn->match_db = kdbus_match_db_new(bus);
 	if (IS_ERR(conn->match_db)) {
 		ret = PTR_ERR(conn->match_db);
 		conn->match_db = NULL;
@@ -1603,7 +2127,7 @@ struct kdbus_conn *kdbus_conn_new(struct kdbus_ep *ep,
 					      KDBUS_ATTACH_CGROUP |
 					      KDBUS_ATTACH_CAPS |
 					      KDBUS_ATTACH_SECLABEL |
-					      KDBUS_ATTACH_AUDIT);
+					      KDBUS_ATTACH_AUDIT, bus);
 		if (ret < 0)
 			goto exit_unref;
 	}
@@ -1756,7 +2280,7 @@ exit_disconnect:
  */
 bool kdbus_conn_has_name(struct kdbus_conn *conn, const char *name)
 {
-	struct kdbus_name_entry *e;
+	struct kdbus_name_owner *o;
 	bool match = false;
 
 	/* No need to go further if we do not own names */
@@ -1764,8 +2288,8 @@ bool kdbus_conn_has_name(struct kdbus_conn *conn, const char *name)
 		return false;
 
 	mutex_lock(&conn->lock);
-	list_for_each_entry(e, &conn->names_list, conn_entry) {
-		if (strcmp(e->name, name) == 0) {
+	list_for_each_entry(o, &conn->names_list, conn_entry) {
+		if (strcmp(o->entry->name, name) == 0) {
 			match = true;
 			break;
 		}
@@ -1775,32 +2299,114 @@ bool kdbus_conn_has_name(struct kdbus_conn *conn, const char *name)
 	return match;
 }
 
+/*
+ * Policy decisions only depend on the euid, egid and groups of the
+ * credentials, so the policy view of the connection's own credentials can be
+ * used for any credentials that share those.
+ */
+static bool kdbus_conn_policy_creds_match(const struct kdbus_conn *conn,
+					  const struct cred *conn_creds)
+{
+	return !conn_creds || conn_creds == conn->cred ||
+	       (uid_eq(conn_creds->euid, conn->policy_creds.euid) &&
+		gid_eq(conn_creds->egid, conn->policy_creds.egid) &&
+		conn_creds->group_info == conn->policy_creds.group_info);
+}
+
+/* the policy view of @conn_creds, computed into @buf if needed */
+static const struct kdbus_policy_creds *
+kdbus_conn_policy_creds(const struct kdbus_conn *conn,
+			const struct cred *conn_creds,
+			struct kdbus_policy_creds *buf)
+{
+	if (kdbus_conn_policy_creds_match(conn, conn_creds))
+		return &conn->policy_creds;
+
+	kdbus_policy_creds_init(buf, conn_creds);
+	return buf;
+}
+
 /* query the policy-database for all names of @whom */
-static bool kdbus_conn_policy_query_all(struct kdbus_conn *conn,
-					const struct cred *conn_creds,
+static bool kdbus_conn_policy_query_all(const struct kdbus_policy_creds *creds,
 					struct kdbus_policy_db *db,
 					struct kdbus_conn *whom,
 					unsigned int access)
 {
-	struct kdbus_name_entry *ne;
+	const struct kdbus_name_owner *o;
 	bool pass = false;
 	int res;
 
-	down_read(&db->entries_rwlock);
-	mutex_lock(&whom->lock);
+	/* neither the names of @whom nor the policy need to be locked */
+	rcu_read_lock();
 
-	list_for_each_entry(ne, &whom->names_list, conn_entry) {
-		res = kdbus_policy_query_unlocked(db, conn_creds ? : conn->cred,
-						  ne->name,
-						  kdbus_strhash(ne->name));
+	list_for_each_entry_rcu(o, &whom->names_list, conn_entry) {
+		res = kdbus_policy_query_unlocked(db, creds, o->entry->name,
+						  o->entry->hash);
 		if (res >= (int)access) {
 			pass = true;
 			break;
 		}
 	}
 
-	mutex_unlock(&whom->lock);
-	up_read(&db->entries_rwlock);
+	rcu_read_unlock();
+
+	return pass;
+}
+
+/* run @query for @whom, or return its cached result */
+static bool kdbus_conn_policy_cached(struct kdbus_conn *conn,
+				     const struct cred *conn_creds,
+				     struct kdbus_conn *whom,
+				     unsigned int access,
+				     bool (*query)(struct kdbus_conn *conn,
+					const struct kdbus_policy_creds *creds,
+					struct kdbus_conn *whom))
+{
+	struct kdbus_policy_cache *cache = &conn->policy_cache;
+	unsigned int ep_gen, bus_gen, names_gen, i;
+	struct kdbus_policy_creds creds;
+	bool pass;
+
+	/* decisions are only cached for the connection's own credentials */
+	if (!kdbus_conn_policy_creds_match(conn, conn_creds)) {
+		kdbus_policy_creds_init(&creds, conn_creds);
+		return query(conn, &creds, whom);
+	}
+
+	/*
+	 * Read the generations before querying the databases. If anything
+	 * changes while we query, the result is stored with the old
+	 * generations and will not be used.
+	 */
+	ep_gen = atomic_read(&conn->ep->policy_db.generation);
+	bus_gen = atomic_read(&conn->ep->bus->policy_db.generation);
+	names_gen = atomic_read(&whom->names_generation);
+	smp_rmb();
+
+	i = hash_64(whom->id << 2 | access, KDBUS_CONN_POLICY_CACHE_BITS);
+
+	spin_lock(&cache->lock);
+	if (cache->slots[i].peer_id == whom->id &&
+	    cache->slots[i].access == access &&
+	    cache->slots[i].ep_generation == ep_gen &&
+	    cache->slots[i].bus_generation == bus_gen &&
+	    cache->slots[i].names_generation == names_gen) {
+		pass = cache->slots[i].pass;
+		spin_unlock(&cache->lock);
+		return pass;
+	}
+	spin_unlock(&cache->lock);
+
+	pass = query(conn, &conn->policy_creds, whom);
+
+	spin_lock(&cache->lock);
+	cache->slots[i].peer_id = whom->id;
+	cache->slots[i].access = access;
+	cache->slots[i].ep_generation = ep_gen;
+	cache->slots[i].bus_generation = bus_gen;
+	cache->slots[i].names_generation = names_gen;
+	cache->slots[i].pass = pass;
+	spin_unlock(&cache->lock);
 
 	return pass;
 }
@@ -1819,14 +2425,15 @@ bool kdbus_conn_policy_own_name(struct kdbus_conn *conn,
 				const struct cred *conn_creds,
 				const char *name)
 {
+	const struct kdbus_policy_creds *creds;
 	unsigned int hash = kdbus_strhash(name);
+	struct kdbus_policy_creds buf;
 	int res;
 
-	if (!conn_creds)
-		conn_creds = conn->cred;
+	creds = kdbus_conn_policy_creds(conn, conn_creds, &buf);
 
 	if (conn->ep->has_policy) {
-		res = kdbus_policy_query(&conn->ep->policy_db, conn_creds,
+		res = kdbus_policy_query(&conn->ep->policy_db, creds,
 					 name, hash);
 		if (res < KDBUS_POLICY_OWN)
 			return false;
@@ -1835,18 +2442,37 @@ bool kdbus_conn_policy_own_name(struct kdbus_conn *conn,
 	if (conn->privileged)
 		return true;
 
-	res = kdbus_policy_query(&conn->ep->bus->policy_db, conn_creds,
+	res = kdbus_policy_query(&conn->ep->bus->policy_db, creds,
 				 name, hash);
 	return res >= KDBUS_POLICY_OWN;
 }
 
+static bool __kdbus_conn_policy_talk(struct kdbus_conn *conn,
+				     const struct kdbus_policy_creds *creds,
+				     struct kdbus_conn *to)
+{
+	if (conn->ep->has_policy &&
+	    !kdbus_conn_policy_query_all(creds, &conn->ep->policy_db,
+					 to, KDBUS_POLICY_TALK))
+		return false;
+
+	if (conn->privileged)
+		return true;
+	if (uid_eq(creds->euid, to->cred->uid))
+		return true;
+
+	return kdbus_conn_policy_query_all(creds, &conn->ep->bus->policy_db,
+					   to, KDBUS_POLICY_TALK);
+}
+
 /**
  * kdbus_conn_policy_talk() - verify a connection can talk to a given peer
  * @conn:		Connection that tries to talk
  * @conn_creds:		Credentials of @conn to use for policy check
  * @to:			Connection that is talked to
  *
- * This verifies that @conn is allowed to talk to @to.
+ * This verifies that @conn is allowed to talk to @to. Decisions that need
+ * policy lookups are cached in @conn.
  *
  * Return: true if allowed, false if not.
  */
@@ -1857,19 +2483,14 @@ bool kdbus_conn_policy_talk(struct kdbus_conn *conn,
 	if (!conn_creds)
 		conn_creds = conn->cred;
 
-	if (conn->ep->has_policy &&
-	    !kdbus_conn_policy_query_all(conn, conn_creds, &conn->ep->policy_db,
-					 to, KDBUS_POLICY_TALK))
-		return false;
-
-	if (conn->privileged)
-		return true;
-	if (uid_eq(conn_creds->euid, to->cred->uid))
+	/* no policy lookups needed, don't bother the cache */
+	if (!conn->ep->has_policy &&
+	    (conn->privileged || uid_eq(conn_creds->euid, to->cred->uid)))
 		return true;
 
-	return kdbus_conn_policy_query_all(conn, conn_creds,
-					   &conn->ep->bus->policy_db, to,
-					   KDBUS_POLICY_TALK);
+	return kdbus_conn_policy_cached(conn, conn_creds, to,
+					KDBUS_POLICY_TALK,
+					__kdbus_conn_policy_talk);
 }
 
 /**
@@ -1880,7 +2501,7 @@ bool kdbus_conn_policy_talk(struct kdbus_conn *conn,
  * @name:		Name
  *
  * This verifies that @conn is allowed to see the well-known name @name. Caller
- * must hold policy-lock.
+ * must hold rcu_read_lock().
  *
  * Return: true if allowed, false if not.
  */
@@ -1888,6 +2509,7 @@ bool kdbus_conn_policy_see_name_unlocked(struct kdbus_conn *conn,
 					 const struct cred *conn_creds,
 					 const char *name)
 {
+	struct kdbus_policy_creds buf;
 	int res;
 
 	/*
@@ -1898,8 +2520,8 @@ bool kdbus_conn_policy_see_name_unlocked(struct kdbus_conn *conn,
 		return true;
 
 	res = kdbus_policy_query_unlocked(&conn->ep->policy_db,
-					  conn_creds ? : conn->cred,
-					  name, kdbus_strhash(name));
+				kdbus_conn_policy_creds(conn, conn_creds, &buf),
+				name, kdbus_strhash(name));
 	return res >= KDBUS_POLICY_SEE;
 }
 
@@ -1919,13 +2541,21 @@ bool kdbus_conn_policy_see_name(struct kdbus_conn *conn,
 {
 	bool res;
 
-	down_read(&conn->ep->policy_db.entries_rwlock);
+	rcu_read_lock();
 	res = kdbus_conn_policy_see_name_unlocked(conn, conn_creds, name);
-	up_read(&conn->ep->policy_db.entries_rwlock);
+	rcu_read_unlock();
 
 	return res;
 }
 
+static bool __kdbus_conn_policy_see(struct kdbus_conn *conn,
+				    const struct kdbus_policy_creds *creds,
+				    struct kdbus_conn *whom)
+{
+	return kdbus_conn_policy_query_all(creds, &conn->ep->policy_db, whom,
+					   KDBUS_POLICY_SEE);
+}
+
 /**
  * kdbus_conn_policy_see() - verify a connection can see a given peer
  * @conn:		Connection to verify whether it sees a peer
@@ -1947,10 +2577,12 @@ bool kdbus_conn_policy_see(struct kdbus_conn *conn,
 	 * peers from each other, unless you see at least _one_ name of the
 	 * peer.
 	 */
-	return !conn->ep->has_policy ||
-	       kdbus_conn_policy_query_all(conn, conn_creds,
-					   &conn->ep->policy_db, whom,
-					   KDBUS_POLICY_SEE);
+	if (!conn->ep->has_policy)
+		return true;
+
+	return kdbus_conn_policy_cached(conn, conn_creds, whom,
+					KDBUS_POLICY_SEE,
+					__kdbus_conn_policy_see);
 }
 
 /**
@@ -1983,6 +2615,12 @@ bool kdbus_conn_policy_see_notification(struct kdbus_conn *conn,
 	 *     names are dropped before a peer is removed, those notifications
 	 *     cannot be seen on custom endpoints. Thus, we only pass them
 	 *     through on default endpoints.
+	 *
+	 * KDBUS_ITEM_NAME_DELTA: The batch carries changes of many names, and
+	 *     cannot be filtered per name. Like ID notifications, it is only
+	 *     passed through on default endpoints, where all names are
+	 *     visible. Peers on custom endpoints have to rely on the per-name
+	 *     notifications.
 	 */
 
 	switch (kmsg->notify_type) {
@@ -1994,6 +2632,7 @@ bool kdbus_conn_policy_see_notification(struct kdbus_conn *conn,
 
 	case KDBUS_ITEM_ID_ADD:
 	case KDBUS_ITEM_ID_REMOVE:
+	case KDBUS_ITEM_NAME_DELTA:
 		return !conn->ep->has_policy;
 
 	default:
@@ -16,12 +16,16 @@
 #define __KDBUS_CONNECTION_H
 
 #include <linux/atomic.h>
+#include <linux/hashtable.h>
 #include <linux/kref.h>
 #include <linux/lockdep.h>
 #include <linux/path.h>
+#include <linux/rbtree.h>
 
 #include "limits.h"
 #include "metadata.h"
+#include "names.h"
+#include "policy.h"
 #include "pool.h"
 #include "queue.h"
 #include "util.h"
@@ -30,6 +34,24 @@
 					 KDBUS_HELLO_POLICY_HOLDER | \
 					 KDBUS_HELLO_MONITOR)
 
+/**
+ * struct kdbus_conn_user - messages of one user queued on a connection
+ * @hentry:		Entry in the connection's msg_users hash
+ * @user:		The accounted user
+ * @msg_count:		Number of queued messages from @user
+ * @flow:		Queued messages from @user, in fair queues
+ *
+ * Counters without messages are kept around for reuse, up to
+ * KDBUS_CONN_MAX_IDLE_USERS per connection, so receivers whose queue
+ * oscillates around empty do not allocate a counter for every message.
+ */
+struct kdbus_conn_user {
+	struct hlist_node hentry;
+	struct kdbus_domain_user *user;
+	unsigned int msg_count;
+	struct kdbus_queue_flow flow;
+};
+
 /**
  * struct kdbus_conn - connection to a bus
  * @kref:		Reference count
@@ -42,33 +64,58 @@
  *			debugging. This field is only set when the
  *			connection is created.
  * @ep:			The endpoint this connection belongs to
- * @lock:		Connection data lock
- * @msg_users:		Array to account the number of queued messages per
- *			individual user
- * @msg_users_max:	Size of the users array
+ * @lock:		Connection data lock, except for @queue and the per-user
+ *			message counters, which are protected by the queue lock
+ * @msg_users:		Number of queued messages per individual user, as
+ *			struct kdbus_conn_user hashed by user ID
+ * @msg_users_idle:	Number of entries in @msg_users without messages
+ * @max_msgs:		Maximum number of messages in @queue
+ * @max_msgs_per_user:	Maximum number of messages in @queue from the same
+ *			individual user, once accounting started
  * @hentry:		Entry in ID <-> connection map
  * @ep_entry:		Entry in endpoint
  * @monitor_entry:	Entry in monitor, if the connection is a monitor
- * @names_list:		List of well-known names
+ * @names_list:		Links to the well-known names owned, modified under
+ *			@lock, may be walked under rcu_read_lock()
  * @names_queue_list:	Well-known names this connection waits for
  * @reply_list:		List of connections this connection should
  *			reply to
+ * @reply_hash:		Entries of @reply_list, hashed by replying
+ *			connection and cookie
+ * @reply_deadlines:	Entries of @reply_list whose timeout is handled by
+ *			@work, ordered by deadline
  * @work:		Delayed work to handle timeouts
  * @activator_of:	Well-known name entry this connection acts as an
  *			activator for
  * @match_db:		Subscription filter to broadcast messages
+ * @name_cache:		Recently resolved destination names
+ * @policy_cache:	Recent TALK and SEE policy decisions about peers
  * @meta:		Active connection creator's metadata/credentials,
  *			either from the handle or from HELLO
  * @pool:		The user's buffer to receive messages
  * @user:		Owner of the connection
  * @cred:		The credentials of the connection at creation time
+ * @policy_creds:	Policy view of @cred, computed at creation time
  * @name_count:		Number of owned well-known names
+ * @names_generation:	Incremented whenever @names_list changes
  * @request_count:	Number of pending requests issued by this
  *			connection that are waiting for replies from
  *			other peers
  * @lost_count:		Number of lost broadcast messages
  * @wait:		Wake up this endpoint
+ * @space_wait:		Wake up senders waiting for room in @queue or @pool
+ * @space_seq:		Incremented whenever a message is dequeued or pool
+ *			space is released
+ * @space_lock:		Protects @space_waiters
+ * @space_waiters:	Connections that failed to queue a message on this
+ *			connection, and poll for it to become writable
+ * @space_entry:	Entry in @space_waiters of @space_dst
+ * @space_dst:		Destination this connection last failed to queue a
+ *			message on, while in its @space_waiters. Holds a
+ *			reference, changed under the @space_lock of the
+ *			destination.
  * @queue:		The message queue associated with this connection
+ * @rcu:		RCU head to free the connection after a grace period
  * @privileged:		Whether this connection is privileged on the bus
  * @faked_meta:		Whether the metadata was faked on HELLO
  */
@@ -85,26 +132,41 @@ struct kdbus_conn {
 	const char *description;
 	struct kdbus_ep *ep;
 	struct mutex lock;
-	unsigned int *msg_users;
-	unsigned int msg_users_max;
+	DECLARE_HASHTABLE(msg_users, KDBUS_CONN_MSG_USERS_HASH_BITS);
+	unsigned int msg_users_idle;
+	unsigned int max_msgs;
+	unsigned int max_msgs_per_user;
 	struct hlist_node hentry;
 	struct list_head ep_entry;
 	struct list_head monitor_entry;
 	struct list_head names_list;
 	struct list_head names_queue_list;
 	struct list_head reply_list;
+	DECLARE_HASHTABLE(reply_hash, KDBUS_CONN_REPLY_HASH_BITS);
+	struct rb_root reply_deadlines;
 	struct delayed_work work;
 	struct kdbus_name_entry *activator_of;
 	struct kdbus_match_db *match_db;
+	struct kdbus_name_cache name_cache;
+	struct kdbus_policy_cache policy_cache;
 	struct kdbus_meta_proc *meta;
 	struct kdbus_pool *pool;
 	struct kdbus_domain_user *user;
 	const struct cred *cred;
+	struct kdbus_policy_creds policy_creds;
 	atomic_t name_count;
+	atomic_t names_generation;
 	atomic_t request_count;
 	atomic_t lost_count;
 	wait_queue_head_t wait;
+	wait_queue_head_t space_wait;
+	atomic_t space_seq;
+	spinlock_t space_lock;
+	struct list_head space_waiters;
+	struct list_head space_entry;
+	struct kdbus_conn *space_dst;
 	struct kdbus_queue queue;
+	struct rcu_head rcu;
 
 	bool privileged:1;
 	bool faked_meta:1;
@@ -131,6 +193,9 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 			     struct kdbus_conn *conn_src,
 			     u64 name_id);
 bool kdbus_conn_has_name(struct kdbus_conn *conn, const char *name);
+void kdbus_conn_space_released(struct kdbus_conn *conn);
+void kdbus_conn_user_uncharge(struct kdbus_conn *conn,
+			      struct kdbus_conn_user *u);
 
 /* policy */
 bool kdbus_conn_policy_own_name(struct kdbus_conn *conn,
@@ -208,6 +273,20 @@ static inline int kdbus_conn_is_monitor(const struct kdbus_conn *conn)
 	return conn->flags & KDBUS_HELLO_MONITOR;
 }
 
+/**
+ * kdbus_conn_is_writable() - Check if a connection may send messages again
+ * @conn:		The connection to check
+ *
+ * A connection is not writable after it failed to queue a message on a peer
+ * whose queue or pool was full, until that peer released space.
+ *
+ * Return: true if the connection is writable
+ */
+static inline bool kdbus_conn_is_writable(const struct kdbus_conn *conn)
+{
+	return list_empty_careful(&conn->space_entry);
+}
+
 /**
  * kdbus_conn_lock2() - Lock two connections
  * @a:		connection A to lock or NULL
@@ -243,7 +243,9 @@ static int handle_ep_ioctl_hello(struct kdbus_handle_ep *handle,
 				    KDBUS_HELLO_ACCEPT_FD |
 				    KDBUS_HELLO_ACTIVATOR |
 				    KDBUS_HELLO_POLICY_HOLDER |
-				    KDBUS_HELLO_MONITOR);
+				    KDBUS_HELLO_MONITOR |
+				    KDBUS_HELLO_FAIR_QUEUE |
+				    KDBUS_HELLO_COALESCE_WAKEUP);
 	if (ret < 0)
 		goto exit;
 
@@ -474,7 +476,9 @@ static long handle_ep_ioctl_connected(struct file *file, unsigned int cmd,
 					    KDBUS_NAME_LIST_UNIQUE |
 					    KDBUS_NAME_LIST_NAMES |
 					    KDBUS_NAME_LIST_ACTIVATORS |
-					    KDBUS_NAME_LIST_QUEUED);
+					    KDBUS_NAME_LIST_QUEUED |
+					    KDBUS_NAME_LIST_PAGED |
+					    KDBUS_NAME_LIST_CHANGES);
 		if (ret < 0)
 			break;
 
@@ -501,6 +505,13 @@ static long handle_ep_ioctl_connected(struct file *file, unsigned int cmd,
 					  return_flags))
 			ret = -EFAULT;
 
+		/* return the cursor and generation items */
+		if (copy_to_user((u8 __user *)buf +
+				 offsetof(struct kdbus_cmd_name_list, items),
+				 cmd_list->items,
+				 KDBUS_ITEMS_SIZE(cmd_list, items)))
+			ret = -EFAULT;
+
 		break;
 	}
 
@@ -849,6 +860,8 @@ static long handle_ep_ioctl_connected(struct file *file, unsigned int cmd,
 		if (ret < 0)
 			break;
 
+		kdbus_conn_space_released(conn);
+
 		if (kdbus_member_set_user(&cmd_free->return_flags, buf,
 					  struct kdbus_cmd_free,
 					  return_flags))
@@ -955,7 +968,7 @@ static unsigned int handle_ep_poll(struct file *file,
 				   struct poll_table_struct *wait)
 {
 	struct kdbus_handle_ep *handle = file->private_data;
-	unsigned int mask = POLLOUT | POLLWRNORM;
+	unsigned int mask = 0;
 	int ret;
 
 	/* Only a connected endpoint can read/write data */
@@ -972,9 +985,17 @@ static unsigned int handle_ep_poll(struct file *file,
 
 	poll_wait(file, &handle->conn->wait, wait);
 
-	if (!list_empty(&handle->conn->queue.msg_list))
+	if (!list_empty(&handle->conn->queue.msg_list) ||
+	    !llist_empty(&handle->conn->queue.msg_pending))
 		mask |= POLLIN | POLLRDNORM;
 
+	/*
+	 * After a message could not be queued on a peer whose queue or pool
+	 * was full, POLLOUT is signalled once that peer released space.
+	 */
+	if (kdbus_conn_is_writable(handle->conn))
+		mask |= POLLOUT | POLLWRNORM;
+
 	kdbus_conn_release(handle->conn);
 
 	return mask;
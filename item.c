@@ -118,6 +118,10 @@ static int kdbus_item_validate(const struct kdbus_item *item)
 	case KDBUS_ITEM_ATTACH_FLAGS_SEND:
 	case KDBUS_ITEM_ATTACH_FLAGS_RECV:
 	case KDBUS_ITEM_ID:
+	case KDBUS_ITEM_BUSY_POLL:
+	case KDBUS_ITEM_QUEUE_DEPTH:
+	case KDBUS_ITEM_SEND_TIMEOUT:
+	case KDBUS_ITEM_NAME_LIST_GENERATION:
 		if (payload_size != sizeof(u64))
 			return -EINVAL;
 		break;
@@ -163,6 +167,11 @@ static int kdbus_item_validate(const struct kdbus_item *item)
 			return -EINVAL;
 		break;
 
+	case KDBUS_ITEM_NAME_LIST_CURSOR:
+		if (payload_size != sizeof(struct kdbus_name_list_cursor))
+			return -EINVAL;
+		break;
+
 	case KDBUS_ITEM_NAME_ADD:
 	case KDBUS_ITEM_NAME_REMOVE:
 	case KDBUS_ITEM_NAME_CHANGE:
@@ -182,6 +191,7 @@ static int kdbus_item_validate(const struct kdbus_item *item)
 
 	case KDBUS_ITEM_REPLY_TIMEOUT:
 	case KDBUS_ITEM_REPLY_DEAD:
+	case KDBUS_ITEM_NAME_DELTA:
 		if (payload_size != 0)
 			return -EINVAL;
 		break;
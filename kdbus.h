@@ -208,6 +208,19 @@ struct kdbus_name {
 	char name[0];
 };
 
+/**
+ * struct kdbus_name_list_cursor - position in a paged name listing
+ * @bucket:		Connection hash bucket to continue at
+ * @id:			Last connection ID listed in @bucket
+ *
+ * Userspace should treat the cursor as opaque. A cursor of all zeros starts
+ * a new listing, and is returned once the listing is complete.
+ */
+struct kdbus_name_list_cursor {
+	__u64 bucket;
+	__u64 id;
+};
+
 /**
  * struct kdbus_policy_access - policy access item
  * @type:		One of KDBUS_POLICY_ACCESS_* types
@@ -250,6 +263,16 @@ struct kdbus_policy_access {
  *					receive for each reeceived message
  * @KDBUS_ITEM_ID:			Connection ID
  * @KDBUS_ITEM_NAME:			Well-know name with flags
+ * @KDBUS_ITEM_BUSY_POLL:		Time in nanoseconds a synchronous
+ *					operation may busy-poll for the reply
+ *					before sleeping
+ * @KDBUS_ITEM_QUEUE_DEPTH:		Maximum number of messages queued on a
+ *					connection
+ * @KDBUS_ITEM_SEND_TIMEOUT:		Time until a send operation may wait
+ *					for room in the destination's queue
+ * @KDBUS_ITEM_NAME_LIST_CURSOR:	Position of a paged name listing,
+ *					carries a struct kdbus_name_list_cursor
+ * @KDBUS_ITEM_NAME_LIST_GENERATION:	Generation of the name registry
  * @_KDBUS_ITEM_ATTACH_BASE:		Start of metadata attach items
  * @KDBUS_ITEM_TIMESTAMP:		Timestamp
  * @KDBUS_ITEM_CREDS:			Process credentials
@@ -281,6 +304,9 @@ struct kdbus_policy_access {
  * @KDBUS_ITEM_ID_REMOVE:		Notification in kdbus_notify_id_change
  * @KDBUS_ITEM_REPLY_TIMEOUT:		Timeout has been reached
  * @KDBUS_ITEM_REPLY_DEAD:		Destination died
+ * @KDBUS_ITEM_NAME_DELTA:		Batch of well-known name changes, carrying
+ *					one KDBUS_ITEM_NAME_{ADD,REMOVE,CHANGE}
+ *					item per name
  *
  * N.B: The process and thread COMM fields, as well as the CMDLINE and
  * EXE fields may be altered by unprivileged processes und should
@@ -305,6 +331,11 @@ enum kdbus_item_type {
 	KDBUS_ITEM_ATTACH_FLAGS_RECV,
 	KDBUS_ITEM_ID,
 	KDBUS_ITEM_NAME,
+	KDBUS_ITEM_BUSY_POLL,
+	KDBUS_ITEM_QUEUE_DEPTH,
+	KDBUS_ITEM_SEND_TIMEOUT,
+	KDBUS_ITEM_NAME_LIST_CURSOR,
+	KDBUS_ITEM_NAME_LIST_GENERATION,
 
 	/* keep these item types in sync with KDBUS_ATTACH_* flags */
 	_KDBUS_ITEM_ATTACH_BASE	= 0x1000,
@@ -334,6 +365,7 @@ enum kdbus_item_type {
 	KDBUS_ITEM_ID_REMOVE,
 	KDBUS_ITEM_REPLY_TIMEOUT,
 	KDBUS_ITEM_REPLY_DEAD,
+	KDBUS_ITEM_NAME_DELTA,
 };
 
 /**
@@ -359,6 +391,7 @@ enum kdbus_item_type {
  * @id_change:		KDBUS_ITEM_ID_ADD
  *			KDBUS_ITEM_ID_REMOVE
  * @policy:		KDBUS_ITEM_POLICY_ACCESS
+ * @name_list_cursor:	KDBUS_ITEM_NAME_LIST_CURSOR
  */
 struct kdbus_item {
 	__u64 size;
@@ -384,6 +417,7 @@ struct kdbus_item {
 		struct kdbus_notify_name_change name_change;
 		struct kdbus_notify_id_change id_change;
 		struct kdbus_policy_access policy_access;
+		struct kdbus_name_list_cursor name_list_cursor;
 	};
 };
 
@@ -634,12 +668,19 @@ enum kdbus_policy_type {
  *				a service
  * @KDBUS_HELLO_MONITOR:	Special-purpose connection to monitor
  *				bus traffic
+ * @KDBUS_HELLO_FAIR_QUEUE:	De-queue messages round-robin across the
+ *				sending users, instead of strictly in the
+ *				order they were queued
+ * @KDBUS_HELLO_COALESCE_WAKEUP:	Only wake up the connection when a
+ *				message is queued while its queue is empty
  */
 enum kdbus_hello_flags {
 	KDBUS_HELLO_ACCEPT_FD		=  1ULL <<  0,
 	KDBUS_HELLO_ACTIVATOR		=  1ULL <<  1,
 	KDBUS_HELLO_POLICY_HOLDER	=  1ULL <<  2,
 	KDBUS_HELLO_MONITOR		=  1ULL <<  3,
+	KDBUS_HELLO_FAIR_QUEUE		=  1ULL <<  4,
+	KDBUS_HELLO_COALESCE_WAKEUP	=  1ULL <<  5,
 };
 
 /**
@@ -825,12 +866,20 @@ struct kdbus_name_list {
  * @KDBUS_NAME_LIST_NAMES:	All known well-known names
  * @KDBUS_NAME_LIST_ACTIVATORS:	All activator connections
  * @KDBUS_NAME_LIST_QUEUED:	All queued-up names
+ * @KDBUS_NAME_LIST_PAGED:	Return only a page of the list, starting at
+ *				the position given in the
+ *				KDBUS_ITEM_NAME_LIST_CURSOR item
+ * @KDBUS_NAME_LIST_CHANGES:	Return the changes of name ownership since
+ *				the generation given in the
+ *				KDBUS_ITEM_NAME_LIST_GENERATION item
  */
 enum kdbus_name_list_flags {
 	KDBUS_NAME_LIST_UNIQUE		= 1ULL <<  0,
 	KDBUS_NAME_LIST_NAMES		= 1ULL <<  1,
 	KDBUS_NAME_LIST_ACTIVATORS	= 1ULL <<  2,
 	KDBUS_NAME_LIST_QUEUED		= 1ULL <<  3,
+	KDBUS_NAME_LIST_PAGED		= 1ULL <<  4,
+	KDBUS_NAME_LIST_CHANGES		= 1ULL <<  5,
 };
 
 /**
@@ -844,7 +893,10 @@ enum kdbus_name_list_flags {
  *			allocated memory.
  * @list_size:		Returned size of list in bytes
  * @size:		Output buffer to report size of data at @offset.
- * @items:		Items for the command. Reserved for future use.
+ * @items:		Items for the command. A KDBUS_ITEM_NAME_LIST_CURSOR
+ *			and a KDBUS_ITEM_NAME_LIST_GENERATION item are
+ *			accepted; the kernel stores the position of the next
+ *			page and the current generation in them.
  *
  * This structure is used with the KDBUS_CMD_NAME_LIST ioctl.
  */
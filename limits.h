@@ -65,9 +65,33 @@
 /* maximum size of policy data */
 #define KDBUS_POLICY_MAX_SIZE			SZ_32K
 
-/* maximum number of queued messages in a connection */
+/* maximum number of names carried by one name delta notification */
+#define KDBUS_NOTIFY_NAME_DELTA_MAX		64
+
+/* time to collect notifications before a deferred flush sends them */
+#define KDBUS_NOTIFY_FLUSH_DELAY_MS		1
+
+/* number of name ownership changes kept for KDBUS_NAME_LIST_CHANGES */
+#define KDBUS_NAME_CHANGES_MAX			256
+
+/*
+ * number of records after which a KDBUS_NAME_LIST_PAGED call stops; the
+ * names of one connection are never split across pages
+ */
+#define KDBUS_NAME_LIST_PAGE_SIZE		64
+
+/* number of destination names cached per connection */
+#define KDBUS_CONN_NAME_CACHE_SIZE		4
+
+/* log2 of the number of policy decisions cached per connection */
+#define KDBUS_CONN_POLICY_CACHE_BITS		4
+
+/* default maximum number of queued messages in a connection */
 #define KDBUS_CONN_MAX_MSGS			256
 
+/* upper bound of the queue depth a connection can request on HELLO */
+#define KDBUS_CONN_MAX_MSGS_LIMIT		SZ_64K
+
 /*
  * maximum number of queued messages wich will not be user accounted.
  * after this value is reached each user will have an individual limit.
@@ -76,16 +100,36 @@
 
 /*
  * maximum number of queued messages from the same indvidual user after the
- * the un-accounted value has been hit
+ * the un-accounted value has been hit, for a queue of KDBUS_CONN_MAX_MSGS
+ * messages; deeper queues raise it proportionally. Together with the
+ * un-accounted messages, one user can queue up to 32 messages by default.
  */
 #define KDBUS_CONN_MAX_MSGS_PER_USER		16
 
+/* log2 of the number of buckets of the per-connection user message counters */
+#define KDBUS_CONN_MSG_USERS_HASH_BITS		4
+
+/* number of idle user message counters kept per connection for reuse */
+#define KDBUS_CONN_MAX_IDLE_USERS		16
+
+/* number of message priorities kept in O(1) buckets of a queue */
+#define KDBUS_QUEUE_PRIO_BUCKETS		32
+
+/* lowest message priority value kept in a bucket; others go to a tree */
+#define KDBUS_QUEUE_PRIO_BUCKET_MIN		(-16)
+
 /* maximum number of well-known names per connection */
 #define KDBUS_CONN_MAX_NAMES			256
 
 /* maximum number of queued requests waiting for a reply */
 #define KDBUS_CONN_MAX_REQUESTS_PENDING		128
 
+/* maximum time a synchronous send busy-polls for its reply */
+#define KDBUS_SYNC_BUSY_POLL_MAX_NS		(100 * NSEC_PER_USEC)
+
+/* log2 of the number of buckets of the per-connection reply hash */
+#define KDBUS_CONN_REPLY_HASH_BITS		6
+
 /* maximum number of connections per user in one domain */
 #define KDBUS_USER_MAX_CONN			1024
 
@@ -16,12 +16,15 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
 
 #include "util.h"
 #include "fs.h"
 #include "handle.h"
 #include "metadata.h"
 #include "node.h"
+#include "notify.h"
+#include "reply.h"
 
 /*
  * This is a simplified outline of the internal kdbus object relations, for
@@ -94,9 +97,19 @@ static int __init kdbus_init(void)
 {
 	int ret;
 
+	ret = kdbus_reply_init();
+	if (ret < 0)
+		return ret;
+
+	ret = kdbus_notify_init();
+	if (ret < 0)
+		goto exit_reply;
+
 	kdbus_dir = kobject_create_and_add(KBUILD_MODNAME, fs_kobj);
-	if (!kdbus_dir)
-		return -ENOMEM;
+	if (!kdbus_dir) {
+		ret = -ENOMEM;
+		goto exit_notify;
+	}
 
 	ret = kdbus_fs_init();
 	if (ret < 0) {
@@ -109,6 +122,10 @@ static int __init kdbus_init(void)
 
 exit_dir:
 	kobject_put(kdbus_dir);
+exit_notify:
+	kdbus_notify_exit();
+exit_reply:
+	kdbus_reply_exit();
 	return ret;
 }
 
@@ -116,6 +133,11 @@ static void __exit kdbus_exit(void)
 {
 	kdbus_fs_exit();
 	kobject_put(kdbus_dir);
+	kdbus_notify_exit();
+	kdbus_reply_exit();
+
+	/* wait for pending RCU callbacks, they call into this module */
+	rcu_barrier();
 }
 
 module_init(kdbus_init);
@@ -12,6 +12,7 @@
  * your option) any later version.
  */
 
+#include <linux/bitops.h>
 #include <linux/fs.h>
 #include <linux/hash.h>
 #include <linux/init.h>
@@ -30,11 +31,15 @@
 
 /**
  * struct kdbus_match_db - message filters
+ * @bus:		Bus that counts the notification subscriptions of the
+ *			entries. Not referenced, the owning connection keeps
+ *			it alive.
  * @entries_list:	List of matches
  * @mdb_rwlock:		Match data lock
  * @entries_count:	Number of entries in database
  */
 struct kdbus_match_db {
+	struct kdbus_bus *bus;
 	struct list_head entries_list;
 	struct rw_semaphore mdb_rwlock;
 	unsigned int entries_count;
@@ -43,11 +48,14 @@ struct kdbus_match_db {
 /**
  * struct kdbus_match_entry - a match database entry
  * @cookie:		User-supplied cookie to lookup the entry
+ * @notify_mask:	Kernel notification types the entry can match, as bits
+ *			indexed from _KDBUS_ITEM_KERNEL_BASE
  * @list_entry:		The list entry element for the db list
  * @rules_list:		The list head for tracking rules of this entry
  */
 struct kdbus_match_entry {
 	u64 cookie;
+	unsigned long notify_mask;
 	struct list_head list_entry;
 	struct list_head rules_list;
 };
@@ -112,6 +120,7 @@ static void kdbus_match_rule_free(struct kdbus_match_rule *rule)
 	case KDBUS_ITEM_ID:
 	case KDBUS_ITEM_ID_ADD:
 	case KDBUS_ITEM_ID_REMOVE:
+	case KDBUS_ITEM_NAME_DELTA:
 		break;
 
 	default:
@@ -133,6 +142,69 @@ static void kdbus_match_entry_free(struct kdbus_match_entry *entry)
 	kfree(entry);
 }
 
+/*
+ * Kernel notifications carry a single item, and a rule only matches a
+ * notification of its own type. So an entry can match one type of
+ * notification if all its rules are of that type, and any notification if
+ * it has no rules at all.
+ */
+static unsigned long
+kdbus_match_entry_notify_mask(const struct kdbus_match_entry *entry)
+{
+	struct kdbus_match_rule *r;
+	u64 type = 0;
+
+	list_for_each_entry(r, &entry->rules_list, rules_entry) {
+		if (r->type < _KDBUS_ITEM_KERNEL_BASE ||
+		    (type && type != r->type))
+			return 0;
+
+		type = r->type;
+	}
+
+	if (!type)
+		return BIT(KDBUS_BUS_NOTIFY_TYPES) - 1;
+
+	return BIT(type - _KDBUS_ITEM_KERNEL_BASE);
+}
+
+/* add @delta to the bus-wide subscriber counts of @entry */
+static void kdbus_match_entry_account(struct kdbus_match_db *mdb,
+				      const struct kdbus_match_entry *entry,
+				      int delta)
+{
+	unsigned int i;
+
+	for_each_set_bit(i, &entry->notify_mask, KDBUS_BUS_NOTIFY_TYPES)
+		atomic_add(delta, &mdb->bus->notify_subscribers[i]);
+}
+
+/* unlink and free an entry of @mdb */
+static void kdbus_match_db_entry_free(struct kdbus_match_db *mdb,
+				      struct kdbus_match_entry *entry)
+{
+	kdbus_match_entry_account(mdb, entry, -1);
+	kdbus_match_entry_free(entry);
+}
+
+/**
+ * kdbus_match_notify_subscribed() - check for subscribers of a notification
+ * @bus:		The bus
+ * @type:		KDBUS_ITEM_* type of the kernel notification
+ *
+ * Return: true if any match entry on @bus might match notifications of
+ * @type, false if nobody subscribed to them.
+ */
+bool kdbus_match_notify_subscribed(struct kdbus_bus *bus, u64 type)
+{
+	if (WARN_ON(type < _KDBUS_ITEM_KERNEL_BASE ||
+		    type - _KDBUS_ITEM_KERNEL_BASE >= KDBUS_BUS_NOTIFY_TYPES))
+		return true;
+
+	return atomic_read(&bus->notify_subscribers[type -
+						    _KDBUS_ITEM_KERNEL_BASE]);
+}
+
 /**
  * kdbus_match_db_free() - free match db resources
  * @mdb:		The match database
@@ -146,7 +218,7 @@ void kdbus_match_db_free(struct kdbus_match_db *mdb)
 
 	down_write(&mdb->mdb_rwlock);
 	list_for_each_entry_safe(entry, tmp, &mdb->entries_list, list_entry)
-		kdbus_match_entry_free(entry);
+		kdbus_match_db_entry_free(mdb, entry);
 	up_write(&mdb->mdb_rwlock);
 
 	kfree(mdb);
@@ -154,10 +226,11 @@ void kdbus_match_db_free(struct kdbus_match_db *mdb)
 
 /**
  * kdbus_match_db_new() - create a new match database
+ * @bus:		The bus of the owning connection
  *
  * Return: a new kdbus_match_db on success, ERR_PTR on failure.
  */
-struct kdbus_match_db *kdbus_match_db_new(void)
+struct kdbus_match_db *kdbus_match_db_new(struct kdbus_bus *bus)
 {
 	struct kdbus_match_db *d;
 
@@ -165,6 +238,7 @@ struct kdbus_match_db *kdbus_match_db_new(void)
 	if (!d)
 		return ERR_PTR(-ENOMEM);
 
+	d->bus = bus;
 	init_rwsem(&d->mdb_rwlock);
 	INIT_LIST_HEAD(&d->entries_list);
 
@@ -274,6 +348,9 @@ static bool kdbus_match_rules(const struct kdbus_match_entry *entry,
 
 				break;
 
+			case KDBUS_ITEM_NAME_DELTA:
+				break;
+
 			default:
 				return false;
 			}
@@ -321,7 +398,7 @@ static int kdbus_match_db_remove_unlocked(struct kdbus_match_db *mdb,
 
 	list_for_each_entry_safe(entry, tmp, &mdb->entries_list, list_entry)
 		if (entry->cookie == cookie) {
-			kdbus_match_entry_free(entry);
+			kdbus_match_db_entry_free(mdb, entry);
 			--mdb->entries_count;
 			found = true;
 		}
@@ -354,6 +431,7 @@ static int kdbus_match_db_remove_unlocked(struct kdbus_match_db *mdb,
  * KDBUS_ITEM_ID_ADD:
  * KDBUS_ITEM_ID_REMOVE:	Connection ID changes, carry
  *				kdbus_notify_id_change
+ * KDBUS_ITEM_NAME_DELTA:	Batched well-known name changes, no payload
  *
  * For kdbus_notify_{id,name}_change structs, only the ID and name fields
  * are looked at when adding an entry. The flags are unused.
@@ -467,6 +545,9 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 
 			break;
 
+		case KDBUS_ITEM_NAME_DELTA:
+			break;
+
 		default:
 			ret = -EINVAL;
 			break;
@@ -483,6 +564,8 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 	if (ret < 0)
 		goto exit;
 
+	entry->notify_mask = kdbus_match_entry_notify_mask(entry);
+
 	down_write(&mdb->mdb_rwlock);
 
 	/* Remove any entry that has the same cookie as the current one. */
@@ -497,6 +580,7 @@ int kdbus_match_db_add(struct kdbus_conn *conn,
 		--mdb->entries_count;
 		ret = -EMFILE;
 	} else {
+		kdbus_match_entry_account(mdb, entry, 1);
 		list_add_tail(&entry->list_entry, &mdb->entries_list);
 	}
 
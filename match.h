@@ -15,11 +15,12 @@
 #ifndef __KDBUS_MATCH_H
 #define __KDBUS_MATCH_H
 
+struct kdbus_bus;
 struct kdbus_conn;
 struct kdbus_kmsg;
 struct kdbus_match_db;
 
-struct kdbus_match_db *kdbus_match_db_new(void);
+struct kdbus_match_db *kdbus_match_db_new(struct kdbus_bus *bus);
 void kdbus_match_db_free(struct kdbus_match_db *db);
 int kdbus_match_db_add(struct kdbus_conn *conn,
 		       struct kdbus_cmd_match *cmd);
@@ -28,5 +29,6 @@ int kdbus_match_db_remove(struct kdbus_conn *conn,
 bool kdbus_match_db_match_kmsg(struct kdbus_match_db *db,
 			       struct kdbus_conn *conn_src,
 			       struct kdbus_kmsg *kmsg);
+bool kdbus_match_notify_subscribed(struct kdbus_bus *bus, u64 type);
 
 #endif
@@ -20,6 +20,7 @@
 #include <linux/fs_struct.h>
 #include <linux/init.h>
 #include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
 #include <linux/security.h>
@@ -36,6 +37,9 @@
 #include "metadata.h"
 #include "names.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 /**
  * struct kdbus_meta_proc - Process metadata
  * @kref:		Reference counting
@@ -414,17 +418,78 @@ static void kdbus_meta_proc_collect_audit(struct kdbus_meta_proc *mp)
 #endif
 }
 
+static size_t kdbus_meta_proc_size(const struct kdbus_meta_proc *mp, u64 what)
+{
+	if (!(mp->valid & what))
+		return 0;
+
+	switch (what) {
+	case KDBUS_ATTACH_CREDS:
+		return sizeof(struct kdbus_creds);
+	case KDBUS_ATTACH_PIDS:
+		return sizeof(struct kdbus_pids);
+	case KDBUS_ATTACH_AUXGROUPS:
+		return mp->n_auxgrps * sizeof(u64);
+	case KDBUS_ATTACH_TID_COMM:
+		return strlen(mp->tid_comm) + 1;
+	case KDBUS_ATTACH_PID_COMM:
+		return strlen(mp->pid_comm) + 1;
+	case KDBUS_ATTACH_CMDLINE:
+		return mp->cmdline ? strlen(mp->cmdline) + 1 : 0;
+	case KDBUS_ATTACH_CGROUP:
+		return mp->cgroup ? strlen(mp->cgroup) + 1 : 0;
+	case KDBUS_ATTACH_CAPS:
+		return sizeof(mp->caps);
+	case KDBUS_ATTACH_SECLABEL:
+		return mp->seclabel ? strlen(mp->seclabel) + 1 : 0;
+	case KDBUS_ATTACH_AUDIT:
+		return sizeof(struct kdbus_audit);
+	}
+
+	/* KDBUS_ATTACH_EXE only pins paths; they are resolved on export */
+	return 0;
+}
+
+/*
+ * Collections are only timed while the kdbus_meta_collect tracepoint is
+ * enabled; otherwise, this returns 0 and kdbus_meta_proc_account() skips
+ * the event.
+ */
+static u64 kdbus_meta_clock(void)
+{
+	return trace_kdbus_meta_collect_enabled() ? ktime_get_ns() : 0;
+}
+
+static void kdbus_meta_proc_account(struct kdbus_meta_proc *mp, u64 what,
+				    struct kdbus_bus *bus, u64 start_ns)
+{
+	mp->collected |= what;
+
+	/* the tracepoint might have been enabled after the clock was read */
+	if (start_ns == 0)
+		return;
+
+	trace_kdbus_meta_collect(bus ? bus->node.name : "", what,
+				 ktime_get_ns() - start_ns,
+				 kdbus_meta_proc_size(mp, what));
+}
+
 /**
  * kdbus_meta_proc_collect() - Collect process metadata
  * @mp:		Process metadata object
  * @what:	Attach flags to collect
+ * @bus:	Bus the metadata is collected for, or NULL
  *
- * This collects process metadata from current and saves it in @mp.
+ * This collects process metadata from current and saves it in @mp. While
+ * the kdbus_meta_collect tracepoint is enabled, the time spent and the
+ * number of bytes retained for each item are reported through it.
  *
  * Return: 0 on success, negative error code on failure.
  */
-int kdbus_meta_proc_collect(struct kdbus_meta_proc *mp, u64 what)
+int kdbus_meta_proc_collect(struct kdbus_meta_proc *mp, u64 what,
+			    struct kdbus_bus *bus)
 {
+	u64 start;
 	int ret;
 
 	if (!mp)
@@ -434,76 +499,87 @@ int kdbus_meta_proc_collect(struct kdbus_meta_proc *mp, u64 what)
 
 	if ((what & KDBUS_ATTACH_CREDS) &&
 	    !(mp->collected & KDBUS_ATTACH_CREDS)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_creds(mp);
-		mp->collected |= KDBUS_ATTACH_CREDS;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_CREDS, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_PIDS) &&
 	    !(mp->collected & KDBUS_ATTACH_PIDS)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_pids(mp);
-		mp->collected |= KDBUS_ATTACH_PIDS;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_PIDS, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_AUXGROUPS) &&
 	    !(mp->collected & KDBUS_ATTACH_AUXGROUPS)) {
+		start = kdbus_meta_clock();
 		ret = kdbus_meta_proc_collect_auxgroups(mp);
 		if (ret < 0)
 			goto exit_unlock;
-		mp->collected |= KDBUS_ATTACH_AUXGROUPS;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_AUXGROUPS, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_TID_COMM) &&
 	    !(mp->collected & KDBUS_ATTACH_TID_COMM)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_tid_comm(mp);
-		mp->collected |= KDBUS_ATTACH_TID_COMM;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_TID_COMM, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_PID_COMM) &&
 	    !(mp->collected & KDBUS_ATTACH_PID_COMM)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_pid_comm(mp);
-		mp->collected |= KDBUS_ATTACH_PID_COMM;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_PID_COMM, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_EXE) &&
 	    !(mp->collected & KDBUS_ATTACH_EXE)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_exe(mp);
-		mp->collected |= KDBUS_ATTACH_EXE;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_EXE, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_CMDLINE) &&
 	    !(mp->collected & KDBUS_ATTACH_CMDLINE)) {
+		start = kdbus_meta_clock();
 		ret = kdbus_meta_proc_collect_cmdline(mp);
 		if (ret < 0)
 			goto exit_unlock;
-		mp->collected |= KDBUS_ATTACH_CMDLINE;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_CMDLINE, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_CGROUP) &&
 	    !(mp->collected & KDBUS_ATTACH_CGROUP)) {
+		start = kdbus_meta_clock();
 		ret = kdbus_meta_proc_collect_cgroup(mp);
 		if (ret < 0)
 			goto exit_unlock;
-		mp->collected |= KDBUS_ATTACH_CGROUP;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_CGROUP, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_CAPS) &&
 	    !(mp->collected & KDBUS_ATTACH_CAPS)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_caps(mp);
-		mp->collected |= KDBUS_ATTACH_CAPS;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_CAPS, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_SECLABEL) &&
 	    !(mp->collected & KDBUS_ATTACH_SECLABEL)) {
+		start = kdbus_meta_clock();
 		ret = kdbus_meta_proc_collect_seclabel(mp);
 		if (ret < 0)
 			goto exit_unlock;
-		mp->collected |= KDBUS_ATTACH_SECLABEL;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_SECLABEL, bus, start);
 	}
 
 	if ((what & KDBUS_ATTACH_AUDIT) &&
 	    !(mp->collected & KDBUS_ATTACH_AUDIT)) {
+		start = kdbus_meta_clock();
 		kdbus_meta_proc_collect_audit(mp);
-		mp->collected |= KDBUS_ATTACH_AUDIT;
+		kdbus_meta_proc_account(mp, KDBUS_ATTACH_AUDIT, bus, start);
 	}
 
 	ret = 0;
@@ -682,14 +758,14 @@ static void kdbus_meta_conn_collect_timestamp(struct kdbus_meta_conn *mc,
 static int kdbus_meta_conn_collect_names(struct kdbus_meta_conn *mc,
 					 struct kdbus_conn *conn)
 {
-	const struct kdbus_name_entry *e;
+	const struct kdbus_name_owner *o;
 	struct kdbus_item *item;
 	size_t slen, size;
 
 	size = 0;
-	list_for_each_entry(e, &conn->names_list, conn_entry)
+	list_for_each_entry(o, &conn->names_list, conn_entry)
 		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_name) +
-					strlen(e->name) + 1);
+					strlen(o->entry->name) + 1);
 
 	if (!size)
 		return 0;
@@ -701,7 +777,9 @@ static int kdbus_meta_conn_collect_names(struct kdbus_meta_conn *mc,
 	mc->owned_names_items = item;
 	mc->owned_names_size = size;
 
-	list_for_each_entry(e, &conn->names_list, conn_entry) {
+	list_for_each_entry(o, &conn->names_list, conn_entry) {
+		const struct kdbus_name_entry *e = o->entry;
+
 		slen = strlen(e->name) + 1;
 		kdbus_item_set(item, KDBUS_ITEM_OWNED_NAME, NULL,
 			       sizeof(struct kdbus_name) + slen);
@@ -794,6 +872,7 @@ exit_unlock:
  * @mc:		Connection metadata, or NULL
  * @mask:	Mask of KDBUS_ATTACH_* flags to export
  * @sz:		Pointer to return the buffer size
+ * @bus:	Bus the metadata is exported for, or NULL
  *
  * This function exports information from metadata to allocated buffer.
  * Only information that is requested in @mask and that has been collected
@@ -808,9 +887,11 @@ exit_unlock:
 struct kdbus_item *kdbus_meta_export(struct kdbus_meta_proc *mp,
 				     struct kdbus_meta_conn *mc,
 				     u64 mask,
-				     size_t *sz)
+				     size_t *sz,
+				     struct kdbus_bus *bus)
 {
 	struct user_namespace *user_ns = current_user_ns();
+	u64 start = trace_kdbus_meta_export_enabled() ? ktime_get_ns() : 0;
 	struct kdbus_item *item, *items = NULL;
 	char *exe_pathname = NULL;
 	void *exe_page = NULL;
@@ -1043,6 +1124,10 @@ struct kdbus_item *kdbus_meta_export(struct kdbus_meta_proc *mp,
 	*sz = size;
 	ret = 0;
 
+	if (start)
+		trace_kdbus_meta_export(bus ? bus->node.name : "", mask,
+					ktime_get_ns() - start, size);
+
 exit:
 	if (exe_page)
 		free_page((unsigned long)exe_page);
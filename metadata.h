@@ -15,6 +15,7 @@
 #ifndef __KDBUS_METADATA_H
 #define __KDBUS_METADATA_H
 
+struct kdbus_bus;
 struct kdbus_conn;
 struct kdbus_domain;
 struct kdbus_kmsg;
@@ -28,7 +29,8 @@ extern unsigned long long kdbus_meta_attach_mask;
 struct kdbus_meta_proc *kdbus_meta_proc_new(void);
 struct kdbus_meta_proc *kdbus_meta_proc_ref(struct kdbus_meta_proc *mp);
 struct kdbus_meta_proc *kdbus_meta_proc_unref(struct kdbus_meta_proc *mp);
-int kdbus_meta_proc_collect(struct kdbus_meta_proc *mp, u64 what);
+int kdbus_meta_proc_collect(struct kdbus_meta_proc *mp, u64 what,
+			    struct kdbus_bus *bus);
 int kdbus_meta_proc_fake(struct kdbus_meta_proc *mp,
 			 const struct kdbus_creds *creds,
 			 const struct kdbus_pids *pids,
@@ -45,7 +47,8 @@ int kdbus_meta_conn_collect(struct kdbus_meta_conn *mc,
 struct kdbus_item *kdbus_meta_export(struct kdbus_meta_proc *mp,
 				     struct kdbus_meta_conn *mc,
 				     u64 mask,
-				     size_t *sz);
+				     size_t *sz,
+				     struct kdbus_bus *bus);
 u64 kdbus_meta_calc_attach_flags(const struct kdbus_conn *sender,
 				 const struct kdbus_conn *receiver);
 
@@ -15,10 +15,12 @@
 #include <linux/ctype.h>
 #include <linux/fs.h>
 #include <linux/hash.h>
+#include <linux/jhash.h>
 #include <linux/idr.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/rhashtable.h>
 #include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
@@ -40,6 +42,7 @@
  * @entry_entry:	List element for the list in @entry
  * @conn_entry:		List element for the list in @conn
  * @flags:		The queuing flags
+ * @owner:		Link preallocated for handing the name to @conn
  */
 struct kdbus_name_queue_item {
 	struct kdbus_conn *conn;
@@ -47,15 +50,112 @@ struct kdbus_name_queue_item {
 	struct list_head entry_entry;
 	struct list_head conn_entry;
 	u64 flags;
+	struct kdbus_name_owner *owner;
 };
 
-static void kdbus_name_entry_free(struct kdbus_name_entry *e)
+/**
+ * struct kdbus_name_change - recorded change of name ownership
+ * @owner_id:		ID of the new owner, or 0 if the name was released
+ * @conn_flags:		KDBUS_HELLO_* flags of the new owner
+ * @flags:		KDBUS_NAME_* flags of the new owner
+ * @name:		The well-known name
+ */
+struct kdbus_name_change {
+	u64 owner_id;
+	u64 conn_flags;
+	u64 flags;
+	char *name;
+};
+
+/**
+ * struct kdbus_name_key - lookup key of the name registry
+ * @hash:		Full hash of @name, as returned by kdbus_strhash()
+ * @name:		The well-known name
+ */
+struct kdbus_name_key {
+	u32 hash;
+	const char *name;
+};
+
+static u32 kdbus_name_key_hashfn(const void *data, u32 len, u32 seed)
+{
+	const struct kdbus_name_key *key = data;
+
+	return jhash_1word(key->hash, seed);
+}
+
+static u32 kdbus_name_entry_hashfn(const void *data, u32 len, u32 seed)
+{
+	const struct kdbus_name_entry *e = data;
+
+	return jhash_1word(e->hash, seed);
+}
+
+static int kdbus_name_entry_cmpfn(struct rhashtable_compare_arg *arg,
+				  const void *obj)
 {
-	hash_del(&e->hentry);
+	const struct kdbus_name_key *key = arg->key;
+	const struct kdbus_name_entry *e = obj;
+
+	/* compare the full hash first, to avoid most string compares */
+	if (e->hash != key->hash)
+		return 1;
+
+	return strcmp(e->name, key->name);
+}
+
+static const struct rhashtable_params kdbus_name_params = {
+	.head_offset		= offsetof(struct kdbus_name_entry, hentry),
+	.hashfn			= kdbus_name_key_hashfn,
+	.obj_hashfn		= kdbus_name_entry_hashfn,
+	.obj_cmpfn		= kdbus_name_entry_cmpfn,
+	.automatic_shrinking	= true,
+};
+
+static void kdbus_name_entry_free_rcu(struct rcu_head *rcu)
+{
+	struct kdbus_name_entry *e;
+
+	e = container_of(rcu, struct kdbus_name_entry, rcu);
+	kfree(e->activator_owner);
 	kfree(e->name);
 	kfree(e);
 }
 
+static void __kdbus_name_entry_free(struct kref *kref)
+{
+	struct kdbus_name_entry *e;
+
+	e = container_of(kref, struct kdbus_name_entry, kref);
+
+	/* lockless lookups might still walk over @e */
+	call_rcu(&e->rcu, kdbus_name_entry_free_rcu);
+}
+
+static struct kdbus_name_entry *
+kdbus_name_entry_unref(struct kdbus_name_entry *e)
+{
+	if (e)
+		kref_put(&e->kref, __kdbus_name_entry_free);
+	return NULL;
+}
+
+static void kdbus_name_entry_free(struct kdbus_name_registry *reg,
+				  struct kdbus_name_entry *e)
+{
+	rhashtable_remove_fast(&reg->entries_hash, &e->hentry,
+			       kdbus_name_params);
+
+	/* invalidate cached copies */
+	e->generation++;
+	kdbus_name_entry_unref(e);
+}
+
+static void kdbus_name_entry_destroy(void *ptr, void *arg)
+{
+	kdbus_name_entry_unref(ptr);
+}
+
 /**
  * kdbus_name_registry_free() - drop a name reg's reference
  * @reg:		The name registry, may be %NULL
@@ -64,16 +164,17 @@ static void kdbus_name_entry_free(struct kdbus_name_entry *e)
  */
 void kdbus_name_registry_free(struct kdbus_name_registry *reg)
 {
-	struct kdbus_name_entry *e;
-	struct hlist_node *tmp;
 	unsigned int i;
 
 	if (!reg)
 		return;
 
-	hash_for_each_safe(reg->entries_hash, i, tmp, e, hentry)
-		kdbus_name_entry_free(e);
+	rhashtable_free_and_destroy(&reg->entries_hash,
+				    kdbus_name_entry_destroy, NULL);
 
+	for (i = 0; i < KDBUS_NAME_CHANGES_MAX; i++)
+		kfree(reg->changes[i].name);
+	kfree(reg->changes);
 	kfree(reg);
 }
 
@@ -85,13 +186,28 @@ void kdbus_name_registry_free(struct kdbus_name_registry *reg)
 struct kdbus_name_registry *kdbus_name_registry_new(void)
 {
 	struct kdbus_name_registry *r;
+	int ret;
 
 	r = kzalloc(sizeof(*r), GFP_KERNEL);
 	if (!r)
 		return ERR_PTR(-ENOMEM);
 
-	hash_init(r->entries_hash);
+	r->changes = kcalloc(KDBUS_NAME_CHANGES_MAX, sizeof(*r->changes),
+			     GFP_KERNEL);
+	if (!r->changes) {
+		kfree(r);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	ret = rhashtable_init(&r->entries_hash, &kdbus_name_params);
+	if (ret < 0) {
+		kfree(r->changes);
+		kfree(r);
+		return ERR_PTR(ret);
+	}
+
 	init_rwsem(&r->rwlock);
+	r->changes_first = 1;
 
 	return r;
 }
@@ -99,22 +215,53 @@ struct kdbus_name_registry *kdbus_name_registry_new(void)
 static struct kdbus_name_entry *
 kdbus_name_lookup(struct kdbus_name_registry *reg, u32 hash, const char *name)
 {
-	struct kdbus_name_entry *e;
-
-	hash_for_each_possible(reg->entries_hash, e, hentry, hash)
-		if (strcmp(e->name, name) == 0)
-			return e;
+	struct kdbus_name_key key = {
+		.hash = hash,
+		.name = name,
+	};
 
-	return NULL;
+	return rhashtable_lookup_fast(&reg->entries_hash, &key,
+				      kdbus_name_params);
 }
 
 static void kdbus_name_queue_item_free(struct kdbus_name_queue_item *q)
 {
 	list_del(&q->entry_entry);
 	list_del(&q->conn_entry);
+	kfree(q->owner);
 	kfree(q);
 }
 
+/*
+ * Record a change of ownership of @e for KDBUS_NAME_LIST_CHANGES. The caller
+ * must hold the registry write-locked. @owner is NULL if the name was
+ * released.
+ */
+static void kdbus_name_log_change(struct kdbus_name_registry *reg,
+				  struct kdbus_name_entry *e,
+				  struct kdbus_conn *owner, u64 flags)
+{
+	u64 generation = ++reg->generation;
+	struct kdbus_name_change *c;
+
+	c = &reg->changes[generation % KDBUS_NAME_CHANGES_MAX];
+	kfree(c->name);
+
+	c->name = kstrdup(e->name, GFP_KERNEL);
+	if (!c->name) {
+		/* the log has a gap now, changes must not be listed across */
+		reg->changes_first = generation + 1;
+		return;
+	}
+
+	c->owner_id = owner ? owner->id : 0;
+	c->conn_flags = owner ? owner->flags : 0;
+	c->flags = flags;
+
+	if (generation - reg->changes_first >= KDBUS_NAME_CHANGES_MAX)
+		reg->changes_first = generation - KDBUS_NAME_CHANGES_MAX + 1;
+}
+
 /*
  * The caller must hold the lock so we decrement the counter and
  * delete the entry.
@@ -130,13 +277,26 @@ static void kdbus_name_entry_remove_owner(struct kdbus_name_entry *e)
 	if (WARN_ON(!mutex_is_locked(&e->conn->lock)))
 		return;
 
+	/*
+	 * Bump the generation before the owner is changed, so lockless
+	 * readers that see the new owner also see the new generation. See
+	 * kdbus_name_entry_get_owner().
+	 */
+	e->generation++;
+	smp_wmb();
+
 	atomic_dec(&e->conn->name_count);
-	list_del(&e->conn_entry);
+	atomic_inc(&e->conn->names_generation);
+	list_del_rcu(&e->owner->conn_entry);
+	kfree_rcu(e->owner, rcu);
+	e->owner = NULL;
 	e->conn = kdbus_conn_unref(e->conn);
 }
 
+/* @o is a new link, owned by @e afterwards */
 static void kdbus_name_entry_set_owner(struct kdbus_name_entry *e,
-				       struct kdbus_conn *conn)
+				       struct kdbus_conn *conn,
+				       struct kdbus_name_owner *o)
 {
 	if (WARN_ON(e->conn))
 		return;
@@ -145,12 +305,21 @@ static void kdbus_name_entry_set_owner(struct kdbus_name_entry *e,
 		return;
 
 	e->conn = kdbus_conn_ref(conn);
+	e->owner = o;
+	o->entry = e;
 	atomic_inc(&conn->name_count);
-	list_add_tail(&e->conn_entry, &e->conn->names_list);
+	atomic_inc(&conn->names_generation);
+	list_add_tail_rcu(&o->conn_entry, &conn->names_list);
 }
 
+/*
+ * Hand @e over to @conn, linked to it by @o. On success, @o is owned by @e,
+ * otherwise it is left to the caller. This does not allocate memory, so
+ * names can be handed over on disconnect without failing.
+ */
 static int kdbus_name_replace_owner(struct kdbus_name_entry *e,
-				    struct kdbus_conn *conn, u64 flags)
+				    struct kdbus_conn *conn, u64 flags,
+				    struct kdbus_name_owner *o)
 {
 	struct kdbus_conn *conn_old = kdbus_conn_ref(e->conn);
 	int ret = 0;
@@ -174,16 +343,19 @@ static int kdbus_name_replace_owner(struct kdbus_name_entry *e,
 
 	/* hand over name ownership */
 	kdbus_name_entry_remove_owner(e);
-	kdbus_name_entry_set_owner(e, conn);
+	kdbus_name_entry_set_owner(e, conn, o);
 	e->flags = flags;
 
+	kdbus_name_log_change(conn->ep->bus->name_registry, e, conn, flags);
+
 exit_unlock:
 	kdbus_conn_unlock2(conn, conn_old);
 	kdbus_conn_unref(conn_old);
 	return ret;
 }
 
-static int kdbus_name_entry_release(struct kdbus_name_entry *e)
+static int kdbus_name_entry_release(struct kdbus_name_registry *reg,
+				    struct kdbus_name_entry *e)
 {
 	struct kdbus_conn *conn;
 	int ret;
@@ -196,12 +368,14 @@ static int kdbus_name_entry_release(struct kdbus_name_entry *e)
 				     struct kdbus_name_queue_item,
 				     entry_entry);
 
-		ret = kdbus_name_replace_owner(e, q->conn, q->flags);
-		if (ret < 0)
-			continue;
+		ret = kdbus_name_replace_owner(e, q->conn, q->flags, q->owner);
+		if (ret == 0)
+			q->owner = NULL;
 
+		/* a waiter that is disconnecting cannot take the name */
 		kdbus_name_queue_item_free(q);
-		return 0;
+		if (ret == 0)
+			return 0;
 	}
 
 	/* hand it back to an active activator connection */
@@ -219,12 +393,18 @@ static int kdbus_name_entry_release(struct kdbus_name_entry *e)
 		if (ret < 0)
 			return ret;
 
-		return kdbus_name_replace_owner(e, e->activator, flags);
+		ret = kdbus_name_replace_owner(e, e->activator, flags,
+					       e->activator_owner);
+		if (ret == 0)
+			e->activator_owner = NULL;
+
+		return ret;
 	}
 
 	/* release the name */
 	kdbus_notify_name_change(e->conn->ep->bus, KDBUS_ITEM_NAME_REMOVE,
 				 e->conn->id, 0, e->flags, 0, e->name);
+	kdbus_name_log_change(reg, e, NULL, 0);
 
 	conn = kdbus_conn_ref(e->conn);
 	mutex_lock(&conn->lock);
@@ -232,7 +412,7 @@ static int kdbus_name_entry_release(struct kdbus_name_entry *e)
 	mutex_unlock(&conn->lock);
 	kdbus_conn_unref(conn);
 
-	kdbus_name_entry_free(e);
+	kdbus_name_entry_free(reg, e);
 
 	return 0;
 }
@@ -258,7 +438,7 @@ static int kdbus_name_release(struct kdbus_name_registry *reg,
 
 	/* Is the connection already the real owner of the name? */
 	if (e->conn == conn) {
-		ret = kdbus_name_entry_release(e);
+		ret = kdbus_name_entry_release(reg, e);
 	} else {
 		/*
 		 * Otherwise, walk the list of queued entries and search
@@ -293,28 +473,34 @@ void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 			       struct kdbus_conn *conn)
 {
 	struct kdbus_name_queue_item *q_tmp, *q;
+	struct kdbus_name_owner *o_tmp, *o;
 	struct kdbus_conn *activator = NULL;
-	struct kdbus_name_entry *e_tmp, *e;
 	LIST_HEAD(names_queue_list);
-	LIST_HEAD(names_list);
 
 	/* lock order: domain -> bus -> ep -> names -> conn */
 	mutex_lock(&conn->ep->bus->lock);
 	down_write(&reg->rwlock);
 
 	mutex_lock(&conn->lock);
-	list_splice_init(&conn->names_list, &names_list);
 	list_splice_init(&conn->names_queue_list, &names_queue_list);
 	mutex_unlock(&conn->lock);
 
 	if (kdbus_conn_is_activator(conn)) {
 		activator = conn->activator_of->activator;
 		conn->activator_of->activator = NULL;
+		kfree(conn->activator_of->activator_owner);
+		conn->activator_of->activator_owner = NULL;
 	}
 	list_for_each_entry_safe(q, q_tmp, &names_queue_list, conn_entry)
 		kdbus_name_queue_item_free(q);
-	list_for_each_entry_safe(e, e_tmp, &names_list, conn_entry)
-		kdbus_name_entry_release(e);
+
+	/*
+	 * The names of @conn only change hands with the registry locked, so
+	 * they can be walked without @conn->lock. Releasing a name unlinks
+	 * it from @conn, without touching the links of other names.
+	 */
+	list_for_each_entry_safe(o, o_tmp, &conn->names_list, conn_entry)
+		kdbus_name_entry_release(reg, o->entry);
 
 	up_write(&reg->rwlock);
 	mutex_unlock(&conn->ep->bus->lock);
@@ -323,6 +509,156 @@ void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 	kdbus_notify_flush(conn->ep->bus);
 }
 
+/**
+ * kdbus_name_cache_init() - initialize a name cache
+ * @cache:		The cache to initialize
+ */
+void kdbus_name_cache_init(struct kdbus_name_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	spin_lock_init(&cache->lock);
+}
+
+/**
+ * kdbus_name_cache_clear() - drop all entries of a name cache
+ * @cache:		The cache to clear
+ */
+void kdbus_name_cache_clear(struct kdbus_name_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache->slots); i++)
+		cache->slots[i].entry =
+			kdbus_name_entry_unref(cache->slots[i].entry);
+}
+
+/*
+ * Return a new reference to the owner of @e, if the entry is still at
+ * @generation. Ownership changes bump the generation before the owner is
+ * replaced, so if the generation is unchanged after @conn was read, @conn is
+ * the owner of @generation. Connections are freed after a grace period, so
+ * @conn is either valid memory or NULL.
+ */
+static struct kdbus_conn *
+kdbus_name_entry_get_owner(struct kdbus_name_entry *e,
+			   unsigned int generation)
+{
+	struct kdbus_conn *conn;
+
+	rcu_read_lock();
+	conn = ACCESS_ONCE(e->conn);
+	smp_rmb();
+	if (!conn || ACCESS_ONCE(e->generation) != generation ||
+	    !kref_get_unless_zero(&conn->kref))
+		conn = NULL;
+	rcu_read_unlock();
+
+	return conn;
+}
+
+/**
+ * kdbus_name_resolve() - look up the owner of a name without locking
+ * @reg:		The name registry
+ * @cache:		Name cache of the caller, or NULL
+ * @name:		The name to look up
+ * @name_id:		Pointer to store the name_id of the entry
+ * @activator:		Pointer to store whether the name has an activator
+ *
+ * Search for a name in a given name registry and return its current owner.
+ * This does not take the registry lock, so the returned owner is only a
+ * snapshot and the name might change ownership right after this returns.
+ * Callers that need the ownership to stay stable must use kdbus_name_lock()
+ * instead. This includes queuing a message on a name with an activator, as
+ * releasing such a name moves the messages queued on its owner to the
+ * activator, which must not race with new messages being queued.
+ *
+ * If @cache is given, recently resolved names are looked up there first, and
+ * the entry is added to it on a miss. Cached entries are only used as long
+ * as their ownership did not change. Names with an activator are not cached.
+ *
+ * NULL is also returned if the name is in the middle of an ownership
+ * change. Callers should fall back to kdbus_name_lock() in that case, to get
+ * an authoritative answer.
+ *
+ * Return: NULL if the name is unknown, otherwise a new reference to the
+ *         connection owning it.
+ */
+struct kdbus_conn *kdbus_name_resolve(struct kdbus_name_registry *reg,
+				      struct kdbus_name_cache *cache,
+				      const char *name, u64 *name_id,
+				      bool *activator)
+{
+	struct kdbus_name_entry *e, *stale = NULL;
+	struct kdbus_conn *conn = NULL;
+	unsigned int i, generation;
+
+	*activator = false;
+
+	if (cache) {
+		spin_lock(&cache->lock);
+		for (i = 0; i < ARRAY_SIZE(cache->slots); i++) {
+			e = cache->slots[i].entry;
+			if (!e || strcmp(e->name, name) != 0)
+				continue;
+
+			conn = kdbus_name_entry_get_owner(e,
+						cache->slots[i].generation);
+			if (conn) {
+				*name_id = e->name_id;
+				*activator = !!ACCESS_ONCE(e->activator);
+			}
+
+			/* ownership changed, or an activator showed up */
+			if (!conn || *activator) {
+				stale = e;
+				cache->slots[i].entry = NULL;
+			}
+
+			break;
+		}
+		spin_unlock(&cache->lock);
+
+		kdbus_name_entry_unref(stale);
+		if (conn)
+			return conn;
+	}
+
+	rcu_read_lock();
+	e = kdbus_name_lookup(reg, kdbus_strhash(name), name);
+	if (e && !kref_get_unless_zero(&e->kref))
+		e = NULL;
+	rcu_read_unlock();
+
+	if (!e)
+		return NULL;
+
+	generation = ACCESS_ONCE(e->generation);
+	smp_rmb();
+	conn = kdbus_name_entry_get_owner(e, generation);
+	if (conn) {
+		*name_id = e->name_id;
+		*activator = !!ACCESS_ONCE(e->activator);
+	}
+
+	/* names with an activator always take the locked path */
+	if (!cache || !conn || *activator) {
+		kdbus_name_entry_unref(e);
+		return conn;
+	}
+
+	spin_lock(&cache->lock);
+	i = cache->next;
+	cache->next = (i + 1) % ARRAY_SIZE(cache->slots);
+	stale = cache->slots[i].entry;
+	cache->slots[i].entry = e;
+	cache->slots[i].generation = generation;
+	spin_unlock(&cache->lock);
+
+	kdbus_name_entry_unref(stale);
+
+	return conn;
+}
+
 /**
  * kdbus_name_lock() - look up a name in a name registry and lock it
  * @reg:		The name registry
@@ -389,6 +725,13 @@ static int kdbus_name_queue_conn(struct kdbus_conn *conn, u64 flags,
 	if (!q)
 		return -ENOMEM;
 
+	/* handing the name to @conn later on must not fail */
+	q->owner = kmalloc(sizeof(*q->owner), GFP_KERNEL);
+	if (!q->owner) {
+		kfree(q);
+		return -ENOMEM;
+	}
+
 	q->conn = conn;
 	q->flags = flags;
 	q->entry = e;
@@ -469,6 +812,7 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 		       const char *name, u64 *flags)
 {
 	struct kdbus_name_entry *e = NULL;
+	struct kdbus_name_owner *o;
 	int ret = 0;
 	u32 hash;
 
@@ -497,6 +841,13 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 				 * Activator registers for name that is
 				 * already owned
 				 */
+				e->activator_owner = kmalloc(sizeof(*o),
+							     GFP_KERNEL);
+				if (!e->activator_owner) {
+					ret = -ENOMEM;
+					goto exit_unlock;
+				}
+
 				e->activator = kdbus_conn_ref(conn);
 				conn->activator_of = e;
 			}
@@ -506,15 +857,27 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 
 		/* take over the name of an activator connection */
 		if (e->flags & KDBUS_NAME_ACTIVATOR) {
+			/* the name must be handed back without failing */
+			if (!e->activator_owner)
+				e->activator_owner = kmalloc(sizeof(*o),
+							     GFP_KERNEL);
+			o = kmalloc(sizeof(*o), GFP_KERNEL);
+			if (!o || !e->activator_owner) {
+				kfree(o);
+				ret = -ENOMEM;
+				goto exit_unlock;
+			}
+
 			/*
 			 * Take over the messages queued in the activator
 			 * connection, the activator itself never reads them.
 			 */
 			ret = kdbus_conn_move_messages(conn, e->activator, 0);
+			if (ret == 0)
+				ret = kdbus_name_replace_owner(e, conn, *flags,
+							       o);
 			if (ret < 0)
-				goto exit_unlock;
-
-			ret = kdbus_name_replace_owner(e, conn, *flags);
+				kfree(o);
 			goto exit_unlock;
 		}
 
@@ -525,14 +888,24 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 			 * Move name back to the queue, in case we take it away
 			 * from a connection which asked for queuing.
 			 */
+			o = kmalloc(sizeof(*o), GFP_KERNEL);
+			if (!o) {
+				ret = -ENOMEM;
+				goto exit_unlock;
+			}
+
 			if (e->flags & KDBUS_NAME_QUEUE) {
 				ret = kdbus_name_queue_conn(e->conn,
 							    e->flags, e);
-				if (ret < 0)
+				if (ret < 0) {
+					kfree(o);
 					goto exit_unlock;
+				}
 			}
 
-			ret = kdbus_name_replace_owner(e, conn, *flags);
+			ret = kdbus_name_replace_owner(e, conn, *flags, o);
+			if (ret < 0)
+				kfree(o);
 			goto exit_unlock;
 		}
 
@@ -568,17 +941,17 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 	}
 
 	e->name = kstrdup(name, GFP_KERNEL);
-	if (!e->name) {
+	o = kmalloc(sizeof(*o), GFP_KERNEL);
+	if (!e->name || !o) {
+		kfree(o);
+		kfree(e->name);
 		kfree(e);
 		ret = -ENOMEM;
 		goto exit_unlock;
 	}
 
-	if (kdbus_conn_is_activator(conn)) {
-		e->activator = kdbus_conn_ref(conn);
-		conn->activator_of = e;
-	}
-
+	kref_init(&e->kref);
+	e->hash = hash;
 	e->flags = *flags;
 	INIT_LIST_HEAD(&e->queue_list);
 	e->name_id = ++reg->name_seq_last;
@@ -586,18 +959,33 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 	mutex_lock(&conn->lock);
 	if (!kdbus_conn_active(conn)) {
 		mutex_unlock(&conn->lock);
+		kfree(o);
 		kfree(e->name);
 		kfree(e);
 		ret = -ECONNRESET;
 		goto exit_unlock;
 	}
-	hash_add(reg->entries_hash, &e->hentry, hash);
-	kdbus_name_entry_set_owner(e, conn);
+	ret = rhashtable_insert_fast(&reg->entries_hash, &e->hentry,
+				     kdbus_name_params);
+	if (ret < 0) {
+		mutex_unlock(&conn->lock);
+		kfree(o);
+		kfree(e->name);
+		kfree(e);
+		goto exit_unlock;
+	}
+	kdbus_name_entry_set_owner(e, conn, o);
 	mutex_unlock(&conn->lock);
 
+	if (kdbus_conn_is_activator(conn)) {
+		e->activator = kdbus_conn_ref(conn);
+		conn->activator_of = e;
+	}
+
 	kdbus_notify_name_change(e->conn->ep->bus, KDBUS_ITEM_NAME_ADD,
 				 0, e->conn->id,
 				 0, e->flags, e->name);
+	kdbus_name_log_change(reg, e, conn, e->flags);
 
 exit_unlock:
 	up_write(&reg->rwlock);
@@ -680,12 +1068,46 @@ int kdbus_cmd_name_release(struct kdbus_name_registry *reg,
 	return ret;
 }
 
-static int kdbus_name_list_write(struct kdbus_conn *conn,
-				 struct kdbus_conn *c,
-				 struct kdbus_pool_slice *slice,
-				 size_t *pos,
-				 struct kdbus_name_entry *e,
-				 bool write)
+/**
+ * struct kdbus_name_list_pass - state of one pass over the listed records
+ * @slice:		Slice to write the records to, or NULL when only
+ *			sizing the listing
+ * @size:		Size of @slice
+ * @pos:		Offset of the next record
+ * @count:		Number of records listed so far
+ * @policy:		Endpoint policy to check visibility of names against,
+ *			pinned for both passes
+ * @creds:		Credentials of the caller, for @policy
+ *
+ * Both passes must list the same records, otherwise they would not fit into
+ * the slice allocated after the first one.
+ */
+struct kdbus_name_list_pass {
+	struct kdbus_pool_slice *slice;
+	size_t size;
+	size_t pos;
+	size_t count;
+	struct kdbus_policy_snapshot *policy;
+	struct kdbus_policy_creds creds;
+};
+
+/* whether @name is visible to the caller, on custom endpoints */
+static bool kdbus_name_list_see(struct kdbus_conn *conn,
+				const struct kdbus_name_list_pass *p,
+				const char *name)
+{
+	if (!conn->ep->has_policy)
+		return true;
+
+	return kdbus_policy_snapshot_query(p->policy, &p->creds, name,
+					   kdbus_strhash(name)) >=
+	       KDBUS_POLICY_SEE;
+}
+
+static int kdbus_name_list_write_info(struct kdbus_conn *conn,
+				      u64 owner_id, u64 conn_flags,
+				      const char *name, u64 name_flags,
+				      struct kdbus_name_list_pass *p)
 {
 	struct kvec kvec[4];
 	size_t cnt = 0;
@@ -694,8 +1116,8 @@ static int kdbus_name_list_write(struct kdbus_conn *conn,
 	/* info header */
 	struct kdbus_name_info info = {
 		.size = 0,
-		.owner_id = c->id,
-		.conn_flags = c->flags,
+		.owner_id = owner_id,
+		.conn_flags = conn_flags,
 	};
 
 	/* fake the header of a kdbus_name item */
@@ -705,97 +1127,85 @@ static int kdbus_name_list_write(struct kdbus_conn *conn,
 		u64 flags;
 	} h = {};
 
-	if (e && !kdbus_conn_policy_see_name_unlocked(conn, current_cred(),
-						      e->name))
+	if (name && !kdbus_name_list_see(conn, p, name))
 		return 0;
 
 	kdbus_kvec_set(&kvec[cnt++], &info, sizeof(info), &info.size);
 
 	/* append name */
-	if (e) {
-		size_t slen = strlen(e->name) + 1;
+	if (name) {
+		size_t slen = strlen(name) + 1;
 
 		h.size = offsetof(struct kdbus_item, name.name) + slen;
 		h.type = KDBUS_ITEM_OWNED_NAME;
-		h.flags = e->flags;
+		h.flags = name_flags;
 
 		kdbus_kvec_set(&kvec[cnt++], &h, sizeof(h), &info.size);
-		kdbus_kvec_set(&kvec[cnt++], e->name, slen, &info.size);
+		kdbus_kvec_set(&kvec[cnt++], name, slen, &info.size);
 		cnt += !!kdbus_kvec_pad(&kvec[cnt], &info.size);
 	}
 
-	if (write) {
-		ret = kdbus_pool_slice_copy_kvec(slice, *pos, kvec,
+	if (p->slice) {
+		if (WARN_ON(p->pos + info.size > p->size))
+			return -EFAULT;
+
+		ret = kdbus_pool_slice_copy_kvec(p->slice, p->pos, kvec,
 						 cnt, info.size);
 		if (ret < 0)
 			return ret;
 	}
 
-	*pos += info.size;
+	p->pos += info.size;
+	p->count++;
 	return 0;
 }
 
-static int kdbus_name_list_all(struct kdbus_conn *conn, u64 flags,
-			       struct kdbus_pool_slice *slice,
-			       size_t *pos, bool write)
+static int kdbus_name_list_write(struct kdbus_conn *conn,
+				 struct kdbus_conn *c,
+				 struct kdbus_name_entry *e,
+				 struct kdbus_name_list_pass *p)
 {
-	struct kdbus_conn *c;
-	size_t p = *pos;
-	int ret, i;
-
-	hash_for_each(conn->ep->bus->conn_hash, i, c, hentry) {
-		bool added = false;
-
-		/* skip activators */
-		if (!(flags & KDBUS_NAME_LIST_ACTIVATORS) &&
-		    kdbus_conn_is_activator(c))
-			continue;
-
-		/* all names the connection owns */
-		if (flags & (KDBUS_NAME_LIST_NAMES |
-			     KDBUS_NAME_LIST_ACTIVATORS)) {
-			struct kdbus_name_entry *e;
-
-			mutex_lock(&c->lock);
-			list_for_each_entry(e, &c->names_list, conn_entry) {
-				struct kdbus_conn *a = e->activator;
-
-				if ((flags & KDBUS_NAME_LIST_ACTIVATORS) &&
-				    a && a != c) {
-					ret = kdbus_name_list_write(conn, a,
-							slice, &p, e, write);
-					if (ret < 0) {
-						mutex_unlock(&c->lock);
-						return ret;
-					}
-
-					added = true;
-				}
+	return kdbus_name_list_write_info(conn, c->id, c->flags,
+					  e ? e->name : NULL, e ? e->flags : 0,
+					  p);
+}
+
+static int kdbus_name_list_conn(struct kdbus_conn *conn,
+				struct kdbus_conn *c, u64 flags,
+				struct kdbus_name_list_pass *p)
+{
+	bool added = false;
+	int ret;
+
+	/* skip activators */
+	if (!(flags & KDBUS_NAME_LIST_ACTIVATORS) &&
+	    kdbus_conn_is_activator(c))
+		return 0;
+
+	/* all names the connection owns */
+	if (flags & (KDBUS_NAME_LIST_NAMES |
+		     KDBUS_NAME_LIST_ACTIVATORS)) {
+		struct kdbus_name_owner *o;
 
-				if (flags & KDBUS_NAME_LIST_NAMES ||
-				    kdbus_conn_is_activator(c)) {
-					ret = kdbus_name_list_write(conn, c,
-							slice, &p, e, write);
-					if (ret < 0) {
-						mutex_unlock(&c->lock);
-						return ret;
-					}
+		mutex_lock(&c->lock);
+		list_for_each_entry(o, &c->names_list, conn_entry) {
+			struct kdbus_name_entry *e = o->entry;
+			struct kdbus_conn *a = e->activator;
 
-					added = true;
+			if ((flags & KDBUS_NAME_LIST_ACTIVATORS) &&
+			    a && a != c) {
+				ret = kdbus_name_list_write(conn, a, e, p);
+				if (ret < 0) {
+					mutex_unlock(&c->lock);
+					return ret;
 				}
-			}
-			mutex_unlock(&c->lock);
-		}
 
-		/* queue of names the connection is currently waiting for */
-		if (flags & KDBUS_NAME_LIST_QUEUED) {
-			struct kdbus_name_queue_item *q;
+				added = true;
+			}
 
-			mutex_lock(&c->lock);
-			list_for_each_entry(q, &c->names_queue_list,
-					    conn_entry) {
-				ret = kdbus_name_list_write(conn, c,
-						slice, &p, q->entry, write);
+			if (flags & KDBUS_NAME_LIST_NAMES ||
+			    kdbus_conn_is_activator(c)) {
+				ret = kdbus_name_list_write(conn, c, e, p);
 				if (ret < 0) {
 					mutex_unlock(&c->lock);
 					return ret;
@@ -803,62 +1213,245 @@ static int kdbus_name_list_all(struct kdbus_conn *conn, u64 flags,
 
 				added = true;
 			}
-			mutex_unlock(&c->lock);
 		}
+		mutex_unlock(&c->lock);
+	}
+
+	/* queue of names the connection is currently waiting for */
+	if (flags & KDBUS_NAME_LIST_QUEUED) {
+		struct kdbus_name_queue_item *q;
+
+		mutex_lock(&c->lock);
+		list_for_each_entry(q, &c->names_queue_list,
+				    conn_entry) {
+			ret = kdbus_name_list_write(conn, c, q->entry, p);
+			if (ret < 0) {
+				mutex_unlock(&c->lock);
+				return ret;
+			}
+
+			added = true;
+		}
+		mutex_unlock(&c->lock);
+	}
 
-		/* nothing added so far, just add the unique ID */
-		if (!added && flags & KDBUS_NAME_LIST_UNIQUE) {
-			ret = kdbus_name_list_write(conn, c,
-					slice, &p, NULL, write);
+	/* nothing added so far, just add the unique ID */
+	if (!added && flags & KDBUS_NAME_LIST_UNIQUE) {
+		ret = kdbus_name_list_write(conn, c, NULL, p);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* list all connections of the bus */
+static int kdbus_name_list_all(struct kdbus_conn *conn, u64 flags,
+			       struct kdbus_name_list_pass *p)
+{
+	struct kdbus_bus *bus = conn->ep->bus;
+	struct kdbus_conn *c;
+	unsigned int i;
+	int ret;
+
+	hash_for_each(bus->conn_hash, i, c, hentry) {
+		ret = kdbus_name_list_conn(conn, c, flags, p);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* the connection in @bucket with the lowest ID above @id, or NULL */
+static struct kdbus_conn *kdbus_name_list_next(struct kdbus_bus *bus,
+					       unsigned int bucket, u64 id)
+{
+	struct kdbus_conn *c, *next = NULL;
+
+	hlist_for_each_entry(c, &bus->conn_hash[bucket], hentry)
+		if (c->id > id && (!next || c->id < next->id))
+			next = c;
+
+	return next;
+}
+
+/*
+ * List the connections after @cursor, ordered by hash bucket and ID. When
+ * sizing the listing, @next is set to the position of the last connection
+ * once KDBUS_NAME_LIST_PAGE_SIZE records are listed, or cleared if the
+ * listing is complete. When writing the records, the pass stops at @next.
+ */
+static int kdbus_name_list_page(struct kdbus_conn *conn, u64 flags,
+				const struct kdbus_name_list_cursor *cursor,
+				struct kdbus_name_list_cursor *next,
+				struct kdbus_name_list_pass *p)
+{
+	struct kdbus_bus *bus = conn->ep->bus;
+	bool bounded = p->slice && next->id > 0;
+	unsigned int i = cursor->bucket;
+	u64 id = cursor->id;
+	struct kdbus_conn *c;
+	int ret;
+
+	for (; i < HASH_SIZE(bus->conn_hash); i++, id = 0) {
+		if (bounded && i > next->bucket)
+			return 0;
+
+		while ((c = kdbus_name_list_next(bus, i, id))) {
+			if (bounded && i == next->bucket && c->id > next->id)
+				return 0;
+
+			ret = kdbus_name_list_conn(conn, c, flags, p);
 			if (ret < 0)
 				return ret;
+
+			id = c->id;
+
+			if (!p->slice && p->count >= KDBUS_NAME_LIST_PAGE_SIZE) {
+				next->bucket = i;
+				next->id = id;
+				return 0;
+			}
 		}
 	}
 
-	*pos = p;
+	if (!p->slice) {
+		next->bucket = 0;
+		next->id = 0;
+	}
+
 	return 0;
 }
 
+/* list all ownership changes recorded after generation @since */
+static int kdbus_name_list_changes(struct kdbus_conn *conn,
+				   struct kdbus_name_registry *reg, u64 since,
+				   struct kdbus_name_list_pass *p)
+{
+	struct kdbus_name_change *c;
+	u64 generation;
+	int ret;
+
+	for (generation = since + 1; generation <= reg->generation;
+	     generation++) {
+		c = &reg->changes[generation % KDBUS_NAME_CHANGES_MAX];
+		ret = kdbus_name_list_write_info(conn, c->owner_id,
+						 c->conn_flags, c->name,
+						 c->flags, p);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int kdbus_name_list_records(struct kdbus_name_registry *reg,
+				   struct kdbus_conn *conn, u64 flags,
+				   const struct kdbus_item *cursor,
+				   struct kdbus_name_list_cursor *next,
+				   const struct kdbus_item *generation,
+				   struct kdbus_name_list_pass *p)
+{
+	if (flags & KDBUS_NAME_LIST_CHANGES)
+		return kdbus_name_list_changes(conn, reg,
+					       generation->data64[0], p);
+
+	if (flags & KDBUS_NAME_LIST_PAGED)
+		return kdbus_name_list_page(conn, flags,
+					    &cursor->name_list_cursor,
+					    next, p);
+
+	return kdbus_name_list_all(conn, flags, p);
+}
+
 /**
  * kdbus_cmd_name_list() - list names of a connection
  * @reg:		The name registry
  * @conn:		The connection holding the name entries
  * @cmd:		The command as passed in by the ioctl
  *
+ * With KDBUS_NAME_LIST_PAGED, the position of the next page is stored in
+ * the KDBUS_ITEM_NAME_LIST_CURSOR item of @cmd. The current generation of
+ * the registry is stored in the KDBUS_ITEM_NAME_LIST_GENERATION item, if
+ * any. The caller has to copy the items back to userspace.
+ *
  * Return: 0 on success, negative errno on failure.
  */
 int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 			struct kdbus_conn *conn,
 			struct kdbus_cmd_name_list *cmd)
 {
+	struct kdbus_item *item, *cursor = NULL, *generation = NULL;
 	struct kdbus_pool_slice *slice = NULL;
+	struct kdbus_name_list_pass pass = {};
+	struct kdbus_name_list_cursor next = {};
 	struct kdbus_name_list list = {};
-	const struct kdbus_item *item;
 	struct kvec kvec;
-	size_t pos;
 	int ret;
 
 	KDBUS_ITEMS_FOREACH(item, cmd->items, KDBUS_ITEMS_SIZE(cmd, items)) {
-		/* no items supported so far */
 		switch (item->type) {
+		case KDBUS_ITEM_NAME_LIST_CURSOR:
+			if (cursor)
+				return -EEXIST;
+			cursor = item;
+			break;
+
+		case KDBUS_ITEM_NAME_LIST_GENERATION:
+			if (generation)
+				return -EEXIST;
+			generation = item;
+			break;
+
 		default:
 			return -EINVAL;
 		}
 	}
 
+	if ((cmd->flags & KDBUS_NAME_LIST_PAGED) &&
+	    (cmd->flags & KDBUS_NAME_LIST_CHANGES))
+		return -EINVAL;
+
+	if ((cmd->flags & KDBUS_NAME_LIST_PAGED) &&
+	    (!cursor || cursor->name_list_cursor.bucket >=
+			HASH_SIZE(conn->ep->bus->conn_hash)))
+		return -EINVAL;
+
+	if ((cmd->flags & KDBUS_NAME_LIST_CHANGES) && !generation)
+		return -EINVAL;
+
+	if (conn->ep->has_policy) {
+		pass.policy = kdbus_policy_snapshot_get(&conn->ep->policy_db);
+		kdbus_policy_creds_init(&pass.creds, current_cred());
+	}
+
 	/* lock order: domain -> bus -> ep -> names -> conn */
 	down_read(&reg->rwlock);
 	down_read(&conn->ep->bus->conn_rwlock);
-	down_read(&conn->ep->policy_db.entries_rwlock);
+
+	if (cmd->flags & KDBUS_NAME_LIST_CHANGES) {
+		if (generation->data64[0] > reg->generation) {
+			ret = -EINVAL;
+			goto exit_unlock;
+		}
+
+		/* the log does not reach back far enough */
+		if (generation->data64[0] + 1 < reg->changes_first) {
+			ret = -ESTALE;
+			goto exit_unlock;
+		}
+	}
 
 	/* size of header + records */
-	pos = sizeof(struct kdbus_name_list);
-	ret = kdbus_name_list_all(conn, cmd->flags, NULL, &pos, false);
+	pass.pos = sizeof(struct kdbus_name_list);
+	ret = kdbus_name_list_records(reg, conn, cmd->flags, cursor, &next,
+				      generation, &pass);
 	if (ret < 0)
 		goto exit_unlock;
 
 	/* copy the header, specifying the overall size */
-	list.size = pos;
+	list.size = pass.pos;
 	kvec.iov_base = &list;
 	kvec.iov_len = sizeof(list);
 
@@ -874,18 +1467,28 @@ int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 		goto exit_unlock;
 
 	/* copy the records */
-	pos = sizeof(struct kdbus_name_list);
-	ret = kdbus_name_list_all(conn, cmd->flags, slice, &pos, true);
+	pass.slice = slice;
+	pass.size = list.size;
+	pass.pos = sizeof(struct kdbus_name_list);
+	pass.count = 0;
+	ret = kdbus_name_list_records(reg, conn, cmd->flags, cursor, &next,
+				      generation, &pass);
 	if (ret < 0)
 		goto exit_unlock;
 
 	kdbus_pool_slice_publish(slice, &cmd->offset, &cmd->list_size);
+
+	if (cursor)
+		cursor->name_list_cursor = next;
+	if (generation)
+		generation->data64[0] = reg->generation;
+
 	ret = 0;
 
 exit_unlock:
 	kdbus_pool_slice_release(slice);
-	up_read(&conn->ep->policy_db.entries_rwlock);
 	up_read(&conn->ep->bus->conn_rwlock);
 	up_read(&reg->rwlock);
+	kdbus_policy_snapshot_unref(pass.policy);
 	return ret;
 }
@@ -15,44 +15,119 @@
 #ifndef __KDBUS_NAMES_H
 #define __KDBUS_NAMES_H
 
-#include <linux/hashtable.h>
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
 #include <linux/rwsem.h>
+#include <linux/spinlock.h>
+
+#include "limits.h"
+
+struct kdbus_cmd_name;
+struct kdbus_cmd_name_list;
+struct kdbus_conn;
+struct kdbus_name_change;
+struct kdbus_name_owner;
 
 /**
  * struct kdbus_name_registry - names registered for a bus
- * @entries_hash:	Map of entries
+ * @entries_hash:	Map of entries, resized with the number of names
  * @lock:		Registry data lock
  * @name_seq_last:	Last used sequence number to assign to a name entry
+ * @changes:		Ring buffer of the last KDBUS_NAME_CHANGES_MAX
+ *			ownership changes, indexed by generation
+ * @changes_first:	Oldest generation that is still recorded in @changes
+ * @generation:		Generation of the last ownership change
+ *
+ * Modifications of @entries_hash require @lock to be write-locked. Lookups
+ * can either read-lock @lock, or run under rcu_read_lock(); entries are only
+ * freed after an RCU grace period.
  */
 struct kdbus_name_registry {
-	DECLARE_HASHTABLE(entries_hash, 8);
+	struct rhashtable entries_hash;
 	struct rw_semaphore rwlock;
 	u64 name_seq_last;
+	struct kdbus_name_change *changes;
+	u64 changes_first;
+	u64 generation;
 };
 
 /**
  * struct kdbus_name_entry - well-know name entry
+ * @kref:		Reference count, the registry owns one reference as
+ *			long as the entry is linked
  * @name:		The well-known name
+ * @hash:		Full hash of @name, as returned by kdbus_strhash()
+ * @generation:		Incremented whenever @conn changes, and when the
+ *			entry is unlinked
  * @name_id:		Sequence number of name entry to be able to uniquely
  *			identify a name over its registration lifetime
  * @flags:		KDBUS_NAME_* flags
  * @queue_list:		List of queued waiters for the well-known name
- * @conn_entry:		Entry in connection
+ * @owner:		Link into the names of @conn
  * @hentry:		Entry in registry map
  * @conn:		Connection owning the name
  * @activator:		Connection of the activator queuing incoming messages
+ * @activator_owner:	Link preallocated to hand the name back to @activator,
+ *			present while @activator does not own the name
+ * @rcu:		RCU head to free the entry after a grace period
  */
 struct kdbus_name_entry {
+	struct kref kref;
 	char *name;
+	u32 hash;
+	unsigned int generation;
 	u64 name_id;
 	u64 flags;
 	struct list_head queue_list;
-	struct list_head conn_entry;
-	struct hlist_node hentry;
+	struct kdbus_name_owner *owner;
+	struct rhash_head hentry;
 	struct kdbus_conn *conn;
 	struct kdbus_conn *activator;
+	struct kdbus_name_owner *activator_owner;
+	struct rcu_head rcu;
+};
+
+/**
+ * struct kdbus_name_owner - link of a name into the names of its owner
+ * @conn_entry:		Entry in the names_list of the owner
+ * @entry:		The owned name entry
+ * @rcu:		RCU head to free the link after a grace period
+ *
+ * A new link is allocated whenever a name changes hands, links are never
+ * moved to another connection. This way, the names of a connection can be
+ * walked under rcu_read_lock().
+ */
+struct kdbus_name_owner {
+	struct list_head conn_entry;
+	struct kdbus_name_entry *entry;
+	struct rcu_head rcu;
+};
+
+/**
+ * struct kdbus_name_cache - per-connection cache of resolved names
+ * @lock:		Cache lock
+ * @next:		Index of the slot to replace next
+ * @slots:		Cached entries
+ * @slots.entry:	Referenced name entry, or NULL
+ * @slots.generation:	Generation of @entry at the time it was cached
+ *
+ * A sending connection caches the name entries it recently resolved. A
+ * cached entry is valid as long as its generation did not change, in which
+ * case its owner can be taken without a registry lookup.
+ */
+struct kdbus_name_cache {
+	spinlock_t lock;
+	unsigned int next;
+	struct {
+		struct kdbus_name_entry *entry;
+		unsigned int generation;
+	} slots[KDBUS_CONN_NAME_CACHE_SIZE];
 };
 
+void kdbus_name_cache_init(struct kdbus_name_cache *cache);
+void kdbus_name_cache_clear(struct kdbus_name_cache *cache);
+
 struct kdbus_name_registry *kdbus_name_registry_new(void);
 void kdbus_name_registry_free(struct kdbus_name_registry *reg);
 
@@ -69,6 +144,10 @@ int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 			struct kdbus_conn *conn,
 			struct kdbus_cmd_name_list *cmd);
 
+struct kdbus_conn *kdbus_name_resolve(struct kdbus_name_registry *reg,
+				      struct kdbus_name_cache *cache,
+				      const char *name, u64 *name_id,
+				      bool *activator);
 struct kdbus_name_entry *kdbus_name_lock(struct kdbus_name_registry *reg,
 					 const char *name);
 struct kdbus_name_entry *kdbus_name_unlock(struct kdbus_name_registry *reg,
@@ -13,20 +13,60 @@
  */
 
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/init.h>
+#include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include "bus.h"
 #include "connection.h"
 #include "domain.h"
 #include "endpoint.h"
 #include "item.h"
+#include "match.h"
 #include "message.h"
 #include "notify.h"
+#include "util.h"
+
+/* runs the deferred flushes of all buses */
+static struct workqueue_struct *kdbus_notify_wq;
+
+/**
+ * kdbus_notify_init() - Set up the workqueue for deferred flushes
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_notify_init(void)
+{
+	kdbus_notify_wq = alloc_workqueue("kdbus_notify", WQ_UNBOUND, 0);
+	if (!kdbus_notify_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/**
+ * kdbus_notify_exit() - Wait for deferred flushes and destroy the workqueue
+ */
+void kdbus_notify_exit(void)
+{
+	destroy_workqueue(kdbus_notify_wq);
+}
+
+/*
+ * Whether a broadcast notification of @type can be received by anyone.
+ * Monitors receive all of them, regardless of their matches.
+ */
+static bool kdbus_notify_wanted(struct kdbus_bus *bus, u64 type)
+{
+	return !list_empty(&bus->monitors_list) ||
+	       kdbus_match_notify_subscribed(bus, type);
+}
 
 static inline void kdbus_notify_add_tail(struct kdbus_kmsg *kmsg,
 					 struct kdbus_bus *bus)
@@ -117,6 +157,11 @@ int kdbus_notify_name_change(struct kdbus_bus *bus, u64 type,
 	struct kdbus_kmsg *kmsg = NULL;
 	size_t name_len, extra_size;
 
+	/* name changes are also delivered as part of a delta */
+	if (!kdbus_notify_wanted(bus, type) &&
+	    !kdbus_notify_wanted(bus, KDBUS_ITEM_NAME_DELTA))
+		return 0;
+
 	name_len = strlen(name) + 1;
 	extra_size = sizeof(struct kdbus_notify_name_change) + name_len;
 	kmsg = kdbus_kmsg_new(extra_size);
@@ -156,6 +201,9 @@ int kdbus_notify_id_change(struct kdbus_bus *bus, u64 type, u64 id, u64 flags)
 {
 	struct kdbus_kmsg *kmsg = NULL;
 
+	if (!kdbus_notify_wanted(bus, type))
+		return 0;
+
 	kmsg = kdbus_kmsg_new(sizeof(struct kdbus_notify_id_change));
 	if (IS_ERR(kmsg))
 		return PTR_ERR(kmsg);
@@ -187,6 +235,185 @@ int kdbus_notify_id_change(struct kdbus_bus *bus, u64 type, u64 id, u64 flags)
 	return 0;
 }
 
+/**
+ * struct kdbus_notify_delta - net change of a name within one flush
+ * @hentry:		Entry in the hash of deltas, keyed by @hash
+ * @name:		The well-known name
+ * @hash:		Hash of @name, as returned by kdbus_strhash()
+ * @old_id:		ID and flags of the owner before the first change
+ * @new_id:		ID and flags of the owner after the last change
+ */
+struct kdbus_notify_delta {
+	struct hlist_node hentry;
+	const char *name;
+	unsigned int hash;
+	struct kdbus_notify_id_change old_id;
+	struct kdbus_notify_id_change new_id;
+};
+
+static bool kdbus_notify_is_name_change(const struct kdbus_kmsg *kmsg)
+{
+	switch (kmsg->notify_type) {
+	case KDBUS_ITEM_NAME_ADD:
+	case KDBUS_ITEM_NAME_REMOVE:
+	case KDBUS_ITEM_NAME_CHANGE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool kdbus_notify_delta_is_noop(const struct kdbus_notify_delta *d)
+{
+	return d->old_id.id == d->new_id.id &&
+	       d->old_id.flags == d->new_id.flags;
+}
+
+/*
+ * Build a KDBUS_ITEM_NAME_DELTA notification carrying the @n deltas at
+ * @deltas, leaving out names that end up where they started. Returns NULL
+ * if there is nothing to send.
+ */
+static struct kdbus_kmsg *
+kdbus_notify_delta_new(const struct kdbus_notify_delta *deltas, size_t n)
+{
+	struct kdbus_kmsg *kmsg;
+	struct kdbus_item *item;
+	size_t i, size = 0;
+
+	for (i = 0; i < n; i++) {
+		if (kdbus_notify_delta_is_noop(&deltas[i]))
+			continue;
+
+		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_notify_name_change) +
+					strlen(deltas[i].name) + 1);
+	}
+
+	if (size == 0)
+		return NULL;
+
+	kmsg = kdbus_kmsg_new(size - KDBUS_ITEM_HEADER_SIZE);
+	if (IS_ERR(kmsg))
+		return kmsg;
+
+	kmsg->msg.dst_id = KDBUS_DST_ID_BROADCAST;
+	kmsg->msg.src_id = KDBUS_SRC_ID_KERNEL;
+	kmsg->msg.payload_type = KDBUS_PAYLOAD_KERNEL;
+	kmsg->notify_type = KDBUS_ITEM_NAME_DELTA;
+
+	item = kmsg->msg.items;
+	for (i = 0; i < n; i++) {
+		size_t name_len = strlen(deltas[i].name) + 1;
+
+		if (kdbus_notify_delta_is_noop(&deltas[i]))
+			continue;
+
+		if (deltas[i].old_id.id == 0)
+			item->type = KDBUS_ITEM_NAME_ADD;
+		else if (deltas[i].new_id.id == 0)
+			item->type = KDBUS_ITEM_NAME_REMOVE;
+		else
+			item->type = KDBUS_ITEM_NAME_CHANGE;
+
+		item->size = KDBUS_ITEM_HEADER_SIZE +
+			     sizeof(struct kdbus_notify_name_change) + name_len;
+		item->name_change.old_id = deltas[i].old_id;
+		item->name_change.new_id = deltas[i].new_id;
+		memcpy(item->name_change.name, deltas[i].name, name_len);
+
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
+	return kmsg;
+}
+
+/*
+ * Coalesce all name changes on @notify_list into KDBUS_ITEM_NAME_DELTA
+ * notifications, which are added to @delta_list. Changes of the same name
+ * collapse into one item describing the net change; they are looked up in a
+ * hash sized by the number of changes. Each notification carries at most
+ * KDBUS_NOTIFY_NAME_DELTA_MAX names.
+ */
+static int kdbus_notify_name_delta(const struct list_head *notify_list,
+				   struct list_head *delta_list)
+{
+	struct kdbus_notify_delta *deltas, *d;
+	struct hlist_head *heads, *head;
+	struct kdbus_kmsg *kmsg;
+	size_t i, j, cnt, n = 0;
+	unsigned int bits;
+	int ret = 0;
+
+	list_for_each_entry(kmsg, notify_list, notify_entry)
+		if (kdbus_notify_is_name_change(kmsg))
+			n++;
+
+	if (n == 0)
+		return 0;
+
+	bits = ilog2(n) + 1;
+	heads = kcalloc(1U << bits, sizeof(*heads), GFP_KERNEL);
+	if (!heads)
+		return -ENOMEM;
+
+	deltas = kmalloc_array(n, sizeof(*deltas), GFP_KERNEL);
+	if (!deltas) {
+		kfree(heads);
+		return -ENOMEM;
+	}
+
+	n = 0;
+	list_for_each_entry(kmsg, notify_list, notify_entry) {
+		const struct kdbus_notify_name_change *c;
+		unsigned int hash;
+
+		if (!kdbus_notify_is_name_change(kmsg))
+			continue;
+
+		c = &kmsg->msg.items[0].name_change;
+		hash = kdbus_strhash(kmsg->notify_name);
+		head = &heads[hash_32(hash, bits)];
+
+		hlist_for_each_entry(d, head, hentry)
+			if (d->hash == hash &&
+			    strcmp(d->name, kmsg->notify_name) == 0)
+				break;
+
+		if (!d) {
+			d = &deltas[n++];
+			d->name = kmsg->notify_name;
+			d->hash = hash;
+			d->old_id = c->old_id;
+			hlist_add_head(&d->hentry, head);
+		}
+
+		d->new_id = c->new_id;
+	}
+
+	for (i = 0; i < n; i = j) {
+		/* find the end of the next batch of names to send */
+		for (j = i, cnt = 0; j < n; j++) {
+			if (kdbus_notify_delta_is_noop(&deltas[j]))
+				continue;
+			if (cnt++ == KDBUS_NOTIFY_NAME_DELTA_MAX)
+				break;
+		}
+
+		kmsg = kdbus_notify_delta_new(deltas + i, j - i);
+		if (IS_ERR(kmsg)) {
+			ret = PTR_ERR(kmsg);
+			break;
+		}
+
+		if (kmsg)
+			list_add_tail(&kmsg->notify_entry, delta_list);
+	}
+
+	kfree(deltas);
+	kfree(heads);
+	return ret;
+}
+
 /**
  * kdbus_notify_flush() - send a list of collected messages
  * @bus:		Bus which queues the messages
@@ -196,6 +423,7 @@ int kdbus_notify_id_change(struct kdbus_bus *bus, u64 type, u64 id, u64 flags)
 void kdbus_notify_flush(struct kdbus_bus *bus)
 {
 	LIST_HEAD(notify_list);
+	LIST_HEAD(delta_list);
 	struct kdbus_kmsg *kmsg, *tmp;
 
 	mutex_lock(&bus->notify_flush_lock);
@@ -204,7 +432,26 @@ void kdbus_notify_flush(struct kdbus_bus *bus)
 	list_splice_init(&bus->notify_list, &notify_list);
 	spin_unlock(&bus->notify_lock);
 
+	/*
+	 * Name changes are additionally sent as one coalesced delta, after
+	 * the individual notifications. Nothing can be done if the delta
+	 * cannot be allocated; subscribers can resync with
+	 * KDBUS_NAME_LIST_CHANGES.
+	 */
+	if (kdbus_notify_wanted(bus, KDBUS_ITEM_NAME_DELTA)) {
+		kdbus_notify_name_delta(&notify_list, &delta_list);
+		list_splice_tail(&delta_list, &notify_list);
+	}
+
 	list_for_each_entry_safe(kmsg, tmp, &notify_list, notify_entry) {
+		/* name changes might only have been queued for the delta */
+		if (kmsg->msg.dst_id == KDBUS_DST_ID_BROADCAST &&
+		    !kdbus_notify_wanted(bus, kmsg->notify_type)) {
+			list_del(&kmsg->notify_entry);
+			kdbus_kmsg_free(kmsg);
+			continue;
+		}
+
 		kmsg->seq = atomic64_inc_return(&bus->domain->msg_seq_last);
 		kdbus_meta_conn_collect(kmsg->conn_meta, kmsg, NULL,
 					KDBUS_ATTACH_TIMESTAMP);
@@ -229,6 +476,63 @@ void kdbus_notify_flush(struct kdbus_bus *bus)
 	mutex_unlock(&bus->notify_flush_lock);
 }
 
+/**
+ * kdbus_notify_flush_deferred() - send collected messages from a worker
+ * @bus:		Bus which queues the messages
+ *
+ * Like kdbus_notify_flush(), but leaves the broadcasting to the notification
+ * worker. Used by paths that should not pay for broadcasting notifications,
+ * such as receiving a message.
+ *
+ * The first flush after a quiet period is run by the worker right away.
+ * Flushes requested within KDBUS_NOTIFY_FLUSH_DELAY_MS after that are
+ * deferred to the end of this window, so bursts of notifications are sent
+ * in one batch.
+ */
+void kdbus_notify_flush_deferred(struct kdbus_bus *bus)
+{
+	unsigned long end, now, delay = 0;
+	bool empty;
+
+	/*
+	 * Racing with a new notification is fine, whoever queues one also
+	 * takes care of flushing it.
+	 */
+	spin_lock(&bus->notify_lock);
+	empty = list_empty(&bus->notify_list);
+	spin_unlock(&bus->notify_lock);
+
+	if (empty)
+		return;
+
+	now = jiffies;
+	end = ACCESS_ONCE(bus->notify_batch_end);
+	if (time_before(now, end))
+		delay = end - now;
+
+	/* the pending work owns a reference to the bus */
+	kdbus_bus_ref(bus);
+	if (!queue_delayed_work(kdbus_notify_wq, &bus->notify_work, delay))
+		kdbus_bus_unref(bus);
+}
+
+/**
+ * kdbus_notify_flush_work() - Worker callback for deferred flushes
+ * @work:		Work struct of the bus to flush
+ */
+void kdbus_notify_flush_work(struct work_struct *work)
+{
+	struct kdbus_bus *bus =
+		container_of(work, struct kdbus_bus, notify_work.work);
+
+	/* batch the flushes requested from now on */
+	ACCESS_ONCE(bus->notify_batch_end) = jiffies +
+		msecs_to_jiffies(KDBUS_NOTIFY_FLUSH_DELAY_MS);
+
+	kdbus_notify_flush(bus);
+	kdbus_bus_unref(bus);
+}
+
 /**
  * kdbus_notify_free() - free a list of collected messages
  * @bus:		Bus which queues the messages
@@ -16,6 +16,10 @@
 #define __KDBUS_NOTIFY_H
 
 struct kdbus_bus;
+struct work_struct;
+
+int kdbus_notify_init(void);
+void kdbus_notify_exit(void);
 
 int kdbus_notify_id_change(struct kdbus_bus *bus, u64 type, u64 id, u64 flags);
 int kdbus_notify_reply_timeout(struct kdbus_bus *bus, u64 id, u64 cookie);
@@ -25,6 +29,8 @@ int kdbus_notify_name_change(struct kdbus_bus *bus, u64 type,
 			     u64 old_flags, u64 new_flags,
 			     const char *name);
 void kdbus_notify_flush(struct kdbus_bus *bus);
+void kdbus_notify_flush_deferred(struct kdbus_bus *bus);
+void kdbus_notify_flush_work(struct work_struct *work);
 void kdbus_notify_free(struct kdbus_bus *bus);
 
 #endif
@@ -12,12 +12,18 @@
  * your option) any later version.
  */
 
+#include <linux/bsearch.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/init.h>
+#include <linux/kref.h>
+#include <linux/log2.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
 #include <linux/sizes.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/uaccess.h>
 
 #include "bus.h"
@@ -27,8 +33,6 @@
 #include "names.h"
 #include "policy.h"
 
-#define KDBUS_POLICY_HASH_SIZE	64
-
 /**
  * struct kdbus_policy_db_entry_access - a database entry access item
  * @type:		One of KDBUS_POLICY_ACCESS_* types
@@ -49,24 +53,92 @@ struct kdbus_policy_db_entry_access {
 	struct list_head list;
 };
 
+/**
+ * struct kdbus_policy_uid_access - compiled access rule for a user
+ * @uid:		The global uid
+ * @access:		Highest KDBUS_POLICY_* access granted to @uid
+ */
+struct kdbus_policy_uid_access {
+	kuid_t uid;
+	int access;
+};
+
+/**
+ * struct kdbus_policy_gid_access - compiled access rule for a group
+ * @gid:		The global gid
+ * @access:		Highest KDBUS_POLICY_* access granted to @gid
+ */
+struct kdbus_policy_gid_access {
+	kgid_t gid;
+	int access;
+};
+
 /**
  * struct kdbus_policy_db_entry - a policy database entry
+ * @kref:		Reference count, held by each snapshot containing the
+ *			entry
  * @name:		The name to match the policy entry against
- * @hentry:		The hash entry for the database's entries_hash
+ * @hash:		Hash value of @name
+ * @set_entry:		Entry in the list of entries built by
+ *			kdbus_policy_set()
  * @access_list:	List head for keeping tracks of the entry's
- *			access items.
+ *			access items, until the entry is compiled
+ * @world_access:	Highest access granted to everyone, or -EPERM
+ * @uids:		Access granted to users, sorted by uid
+ * @n_uids:		Number of elements in @uids
+ * @gids:		Access granted to groups, sorted by gid
+ * @n_gids:		Number of elements in @gids
+ * @gids_bloom:		Bloom filter of all gids in @gids
  * @owner:		The owner of this entry. Can be a kdbus_conn or
  *			a kdbus_ep object.
  * @wildcard:		The name is a wildcard, such as ending on '.*'
+ *
+ * Entries are immutable once they are part of a snapshot.
  */
 struct kdbus_policy_db_entry {
+	struct kref kref;
 	char *name;
-	struct hlist_node hentry;
+	u32 hash;
+	struct list_head set_entry;
 	struct list_head access_list;
+	int world_access;
+	struct kdbus_policy_uid_access *uids;
+	size_t n_uids;
+	struct kdbus_policy_gid_access *gids;
+	size_t n_gids;
+	u64 gids_bloom;
 	const void *owner;
 	bool wildcard:1;
 };
 
+/**
+ * struct kdbus_policy_snapshot - immutable set of policy entries
+ * @kref:		Reference count, the database holds one as long as the
+ *			snapshot is published
+ * @rcu:		RCU head to free the snapshot after a grace period
+ * @mask:		Number of @slots minus one
+ * @slots:		Open-addressed hash table of entries, indexed by the
+ *			hash of their name. At most half of the slots are
+ *			used.
+ *
+ * Readers look up entries under rcu_read_lock(), or pin a snapshot with
+ * kdbus_policy_snapshot_get() to run several queries on the same set of
+ * entries. Writers never modify a published snapshot, but replace it with a
+ * new one.
+ */
+struct kdbus_policy_snapshot {
+	struct kref kref;
+	struct rcu_head rcu;
+	unsigned int mask;
+	struct kdbus_policy_db_entry *slots[0];
+};
+
+/*
+ * Marks an entry that was removed from a published snapshot, in the rare
+ * case a new snapshot cannot be allocated. See kdbus_policy_remove_owner().
+ */
+static struct kdbus_policy_db_entry kdbus_policy_tombstone;
+
 static void kdbus_policy_entry_free(struct kdbus_policy_db_entry *e)
 {
 	struct kdbus_policy_db_entry_access *a, *tmp;
@@ -76,20 +148,293 @@ static void kdbus_policy_entry_free(struct kdbus_policy_db_entry *e)
 		kfree(a);
 	}
 
+	kfree(e->uids);
+	kfree(e->gids);
 	kfree(e->name);
 	kfree(e);
 }
 
-static const struct kdbus_policy_db_entry *
-kdbus_policy_lookup(struct kdbus_policy_db *db, const char *name, u32 hash)
+static void __kdbus_policy_entry_free(struct kref *kref)
+{
+	struct kdbus_policy_db_entry *e =
+		container_of(kref, struct kdbus_policy_db_entry, kref);
+
+	kdbus_policy_entry_free(e);
+}
+
+static void kdbus_policy_entry_unref(struct kdbus_policy_db_entry *e)
 {
+	kref_put(&e->kref, __kdbus_policy_entry_free);
+}
+
+static bool kdbus_policy_entry_live(const struct kdbus_policy_db_entry *e)
+{
+	return e && e != &kdbus_policy_tombstone;
+}
+
+/* bit of @gid in a groups bloom filter */
+static u64 kdbus_policy_gid_bloom(kgid_t gid)
+{
+	return BIT_ULL(hash_32(__kgid_val(gid), 6));
+}
+
+static int kdbus_policy_uid_cmp(const void *a, const void *b)
+{
+	const struct kdbus_policy_uid_access *ua = a, *ub = b;
+
+	if (uid_lt(ua->uid, ub->uid))
+		return -1;
+	if (uid_gt(ua->uid, ub->uid))
+		return 1;
+
+	return 0;
+}
+
+static int kdbus_policy_gid_cmp(const void *a, const void *b)
+{
+	const struct kdbus_policy_gid_access *ga = a, *gb = b;
+
+	if (gid_lt(ga->gid, gb->gid))
+		return -1;
+	if (gid_gt(ga->gid, gb->gid))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Compile the access list of @e into tables sorted by uid and gid, with
+ * duplicates merged to the highest access granted. The access list is
+ * released afterwards.
+ */
+static int kdbus_policy_entry_compile(struct kdbus_policy_db_entry *e)
+{
+	struct kdbus_policy_db_entry_access *a, *tmp;
+	size_t i, n, n_uids = 0, n_gids = 0;
+
+	e->world_access = -EPERM;
+
+	list_for_each_entry(a, &e->access_list, list) {
+		if (a->type == KDBUS_POLICY_ACCESS_USER)
+			n_uids++;
+		else if (a->type == KDBUS_POLICY_ACCESS_GROUP)
+			n_gids++;
+	}
+
+	if (n_uids > 0) {
+		e->uids = kmalloc_array(n_uids, sizeof(*e->uids), GFP_KERNEL);
+		if (!e->uids)
+			return -ENOMEM;
+	}
+
+	if (n_gids > 0) {
+		e->gids = kmalloc_array(n_gids, sizeof(*e->gids), GFP_KERNEL);
+		if (!e->gids)
+			return -ENOMEM;
+	}
+
+	list_for_each_entry_safe(a, tmp, &e->access_list, list) {
+		switch (a->type) {
+		case KDBUS_POLICY_ACCESS_USER:
+			e->uids[e->n_uids].uid = a->uid;
+			e->uids[e->n_uids].access = a->access;
+			e->n_uids++;
+			break;
+		case KDBUS_POLICY_ACCESS_GROUP:
+			e->gids[e->n_gids].gid = a->gid;
+			e->gids[e->n_gids].access = a->access;
+			e->n_gids++;
+			break;
+		case KDBUS_POLICY_ACCESS_WORLD:
+			e->world_access = max_t(int, e->world_access,
+						a->access);
+			break;
+		}
+
+		list_del(&a->list);
+		kfree(a);
+	}
+
+	sort(e->uids, e->n_uids, sizeof(*e->uids),
+	     kdbus_policy_uid_cmp, NULL);
+	sort(e->gids, e->n_gids, sizeof(*e->gids),
+	     kdbus_policy_gid_cmp, NULL);
+
+	/* merge duplicates, rules granted to everyone need no entries */
+	for (i = 0, n = 0; i < e->n_uids; i++) {
+		if (e->uids[i].access <= e->world_access)
+			continue;
+
+		if (n > 0 && uid_eq(e->uids[n - 1].uid, e->uids[i].uid))
+			e->uids[n - 1].access = max(e->uids[n - 1].access,
+						    e->uids[i].access);
+		else
+			e->uids[n++] = e->uids[i];
+	}
+	e->n_uids = n;
+
+	for (i = 0, n = 0; i < e->n_gids; i++) {
+		if (e->gids[i].access <= e->world_access)
+			continue;
+
+		if (n > 0 && gid_eq(e->gids[n - 1].gid, e->gids[i].gid))
+			e->gids[n - 1].access = max(e->gids[n - 1].access,
+						    e->gids[i].access);
+		else
+			e->gids[n++] = e->gids[i];
+	}
+	e->n_gids = n;
+
+	for (i = 0; i < e->n_gids; i++)
+		e->gids_bloom |= kdbus_policy_gid_bloom(e->gids[i].gid);
+
+	return 0;
+}
+
+static int kdbus_policy_entry_query_gid(const struct kdbus_policy_db_entry *e,
+					kgid_t gid)
+{
+	const struct kdbus_policy_gid_access *ga;
+	struct kdbus_policy_gid_access key = { .gid = gid };
+
+	ga = bsearch(&key, e->gids, e->n_gids, sizeof(*e->gids),
+		     kdbus_policy_gid_cmp);
+
+	return ga ? ga->access : -EPERM;
+}
+
+static void kdbus_policy_snapshot_free(struct kdbus_policy_snapshot *snap)
+{
+	unsigned int i;
+
+	for (i = 0; i <= snap->mask; i++)
+		if (kdbus_policy_entry_live(snap->slots[i]))
+			kdbus_policy_entry_unref(snap->slots[i]);
+
+	kfree(snap);
+}
+
+static void kdbus_policy_snapshot_free_rcu(struct rcu_head *rcu)
+{
+	kdbus_policy_snapshot_free(container_of(rcu,
+						struct kdbus_policy_snapshot,
+						rcu));
+}
+
+static void __kdbus_policy_snapshot_free(struct kref *kref)
+{
+	struct kdbus_policy_snapshot *snap =
+		container_of(kref, struct kdbus_policy_snapshot, kref);
+
+	/* lockless queries might still walk over @snap */
+	call_rcu(&snap->rcu, kdbus_policy_snapshot_free_rcu);
+}
+
+static int kdbus_policy_snapshot_add(struct kdbus_policy_snapshot *snap,
+				     struct kdbus_policy_db_entry *e)
+{
+	struct kdbus_policy_db_entry *p;
+	unsigned int i;
+
+	for (i = e->hash & snap->mask; (p = snap->slots[i]);
+	     i = (i + 1) & snap->mask) {
+		/* prevent duplicates */
+		if (p->hash == e->hash && p->wildcard == e->wildcard &&
+		    strcmp(p->name, e->name) == 0)
+			return -EEXIST;
+	}
+
+	kref_get(&e->kref);
+	snap->slots[i] = e;
+	return 0;
+}
+
+/*
+ * Create a snapshot with the entries of @old, except the ones of @owner, and
+ * the entries on @entries. Returns NULL if the snapshot would be empty.
+ */
+static struct kdbus_policy_snapshot *
+kdbus_policy_snapshot_new(const struct kdbus_policy_snapshot *old,
+			  const void *owner, struct list_head *entries)
+{
+	struct kdbus_policy_snapshot *snap;
 	struct kdbus_policy_db_entry *e;
+	unsigned int i, n_slots;
+	size_t n = 0;
+	int ret;
+
+	list_for_each_entry(e, entries, set_entry)
+		n++;
+
+	if (old)
+		for (i = 0; i <= old->mask; i++)
+			if (kdbus_policy_entry_live(old->slots[i]) &&
+			    old->slots[i]->owner != owner)
+				n++;
+
+	if (n == 0)
+		return NULL;
+
+	n_slots = roundup_pow_of_two(n * 2);
+	snap = kzalloc(sizeof(*snap) + n_slots * sizeof(*snap->slots),
+		       GFP_KERNEL);
+	if (!snap)
+		return ERR_PTR(-ENOMEM);
+
+	kref_init(&snap->kref);
+	snap->mask = n_slots - 1;
+
+	if (old)
+		for (i = 0; i <= old->mask; i++)
+			if (kdbus_policy_entry_live(old->slots[i]) &&
+			    old->slots[i]->owner != owner)
+				kdbus_policy_snapshot_add(snap, old->slots[i]);
+
+	list_for_each_entry(e, entries, set_entry) {
+		ret = kdbus_policy_snapshot_add(snap, e);
+		if (ret < 0) {
+			kdbus_policy_snapshot_free(snap);
+			return ERR_PTR(ret);
+		}
+	}
+
+	return snap;
+}
+
+/* replace the snapshot of @db, the caller must hold the entries lock */
+static void kdbus_policy_publish(struct kdbus_policy_db *db,
+				 struct kdbus_policy_snapshot *snap)
+{
+	struct kdbus_policy_snapshot *old;
+
+	old = rcu_dereference_protected(db->snapshot,
+					lockdep_is_held(&db->entries_lock));
+	rcu_assign_pointer(db->snapshot, snap);
+
+	/* see kdbus_conn_policy_cached() */
+	smp_mb__before_atomic();
+	atomic_inc(&db->generation);
+
+	kdbus_policy_snapshot_unref(old);
+}
+
+static const struct kdbus_policy_db_entry *
+kdbus_policy_lookup(const struct kdbus_policy_snapshot *snap,
+		    const char *name, u32 hash)
+{
+	const struct kdbus_policy_db_entry *e;
 	const char *dot;
+	unsigned int i;
 	size_t len;
 
+	if (!snap)
+		return NULL;
+
 	/* find exact match */
-	hash_for_each_possible(db->entries_hash, e, hentry, hash)
-		if (strcmp(e->name, name) == 0 && !e->wildcard)
+	for (i = hash & snap->mask; (e = ACCESS_ONCE(snap->slots[i]));
+	     i = (i + 1) & snap->mask)
+		if (kdbus_policy_entry_live(e) && !e->wildcard &&
+		    e->hash == hash && strcmp(e->name, name) == 0)
 			return e;
 
 	/* find wildcard match */
@@ -101,8 +446,10 @@ kdbus_policy_lookup(struct kdbus_policy_db *db, const char *name, u32 hash)
 	len = dot - name;
 	hash = kdbus_strnhash(name, len);
 
-	hash_for_each_possible(db->entries_hash, e, hentry, hash)
-		if (e->wildcard && !strncmp(e->name, name, len) &&
+	for (i = hash & snap->mask; (e = ACCESS_ONCE(snap->slots[i]));
+	     i = (i + 1) & snap->mask)
+		if (kdbus_policy_entry_live(e) && e->wildcard &&
+		    e->hash == hash && !strncmp(e->name, name, len) &&
 		    !e->name[len])
 			return e;
 
@@ -115,17 +462,10 @@ kdbus_policy_lookup(struct kdbus_policy_db *db, const char *name, u32 hash)
  */
 void kdbus_policy_db_clear(struct kdbus_policy_db *db)
 {
-	struct kdbus_policy_db_entry *e;
-	struct hlist_node *tmp;
-	unsigned int i;
-
 	/* purge entries */
-	down_write(&db->entries_rwlock);
-	hash_for_each_safe(db->entries_hash, i, tmp, e, hentry) {
-		hash_del(&e->hentry);
-		kdbus_policy_entry_free(e);
-	}
-	up_write(&db->entries_rwlock);
+	mutex_lock(&db->entries_lock);
+	kdbus_policy_publish(db, NULL);
+	mutex_unlock(&db->entries_lock);
 }
 
 /**
@@ -137,113 +477,189 @@ void kdbus_policy_db_clear(struct kdbus_policy_db *db)
  */
 void kdbus_policy_db_init(struct kdbus_policy_db *db)
 {
-	hash_init(db->entries_hash);
-	init_rwsem(&db->entries_rwlock);
+	RCU_INIT_POINTER(db->snapshot, NULL);
+	mutex_init(&db->entries_lock);
+	atomic_set(&db->generation, 0);
 }
 
 /**
- * kdbus_policy_query_unlocked() - Query the policy database
- * @db:		Policy database
- * @cred:	Credentials to test against
- * @name:	Name to query
- * @hash:	Hash value of @name
+ * kdbus_policy_creds_init() - compute the policy view of credentials
+ * @creds:	Policy credentials to initialize
+ * @cred:	Credentials to take the ids from
  *
- * Same as kdbus_policy_query() but requires the caller to lock the policy
- * database against concurrent writes.
- *
- * Return: The highest KDBUS_POLICY_* access type found, or -EPERM if none.
+ * No reference to @cred is taken, the caller must keep it alive as long as
+ * @creds is used.
  */
-int kdbus_policy_query_unlocked(struct kdbus_policy_db *db,
-				const struct cred *cred, const char *name,
-				unsigned int hash)
+void kdbus_policy_creds_init(struct kdbus_policy_creds *creds,
+			     const struct cred *cred)
 {
-	struct kdbus_policy_db_entry_access *a;
+	int i;
+
+	creds->euid = cred->euid;
+	creds->egid = cred->egid;
+	creds->group_info = cred->group_info;
+	creds->groups_bloom = kdbus_policy_gid_bloom(cred->egid);
+
+	for (i = 0; i < cred->group_info->ngroups; i++)
+		creds->groups_bloom |=
+			kdbus_policy_gid_bloom(GROUP_AT(cred->group_info, i));
+}
+
+/* query @snap for the access of @creds, the caller must hold rcu_read_lock() */
+static int
+kdbus_policy_snapshot_query_unlocked(const struct kdbus_policy_snapshot *snap,
+				     const struct kdbus_policy_creds *creds,
+				     const char *name, unsigned int hash)
+{
+	const struct kdbus_policy_uid_access *ua;
+	struct kdbus_policy_uid_access key = { .uid = creds->euid };
 	const struct kdbus_policy_db_entry *e;
-	int i, highest = -EPERM;
+	int i, highest;
 
-	e = kdbus_policy_lookup(db, name, hash);
+	e = kdbus_policy_lookup(snap, name, hash);
 	if (!e)
 		return -EPERM;
 
-	list_for_each_entry(a, &e->access_list, list) {
-		if ((int)a->access <= highest)
-			continue;
+	highest = e->world_access;
 
-		switch (a->type) {
-		case KDBUS_POLICY_ACCESS_USER:
-			if (uid_eq(cred->euid, a->uid))
-				highest = a->access;
-			break;
-		case KDBUS_POLICY_ACCESS_GROUP:
-			if (gid_eq(cred->egid, a->gid)) {
-				highest = a->access;
-				break;
-			}
+	ua = bsearch(&key, e->uids, e->n_uids, sizeof(*e->uids),
+		     kdbus_policy_uid_cmp);
+	if (ua)
+		highest = max(highest, ua->access);
 
-			for (i = 0; i < cred->group_info->ngroups; i++) {
-				kgid_t gid = GROUP_AT(cred->group_info, i);
+	/*
+	 * @e carries a bloom filter of the gids of all its GROUP rules. If
+	 * it shares no bit with the filter of the caller's egid and groups,
+	 * none of the groups has a GROUP rule in @e and we can skip them.
+	 */
+	if (!(e->gids_bloom & creds->groups_bloom))
+		return highest;
 
-				if (gid_eq(gid, a->gid)) {
-					highest = a->access;
-					break;
-				}
-			}
+	highest = max(highest, kdbus_policy_entry_query_gid(e, creds->egid));
 
-			break;
-		case KDBUS_POLICY_ACCESS_WORLD:
-			highest = a->access;
-			break;
-		}
+	/* OWN is the highest possible policy */
+	for (i = 0; i < creds->group_info->ngroups &&
+		    highest < KDBUS_POLICY_OWN; i++) {
+		kgid_t gid = GROUP_AT(creds->group_info, i);
 
-		/* OWN is the highest possible policy */
-		if (highest >= KDBUS_POLICY_OWN)
-			break;
+		highest = max(highest, kdbus_policy_entry_query_gid(e, gid));
 	}
 
 	return highest;
 }
 
+/**
+ * kdbus_policy_query_unlocked() - Query the policy database
+ * @db:		Policy database
+ * @creds:	Credentials to test against
+ * @name:	Name to query
+ * @hash:	Hash value of @name
+ *
+ * Same as kdbus_policy_query() but requires the caller to hold
+ * rcu_read_lock().
+ *
+ * Return: The highest KDBUS_POLICY_* access type found, or -EPERM if none.
+ */
+int kdbus_policy_query_unlocked(struct kdbus_policy_db *db,
+				const struct kdbus_policy_creds *creds,
+				const char *name, unsigned int hash)
+{
+	return kdbus_policy_snapshot_query_unlocked(rcu_dereference(db->snapshot),
+						    creds, name, hash);
+}
+
 /**
  * kdbus_policy_query() - Query the policy database
  * @db:		Policy database
- * @cred:	Credentials to test against
+ * @creds:	Credentials to test against
  * @name:	Name to query
  * @hash:	Hash value of @name
  *
- * Query the policy database @db for the access rights of @cred to the name
- * @name. The access rights of @cred are returned, or -EPERM if no access is
+ * Query the policy database @db for the access rights of @creds to the name
+ * @name. The access rights of @creds are returned, or -EPERM if no access is
  * granted.
  *
  * This call effectively searches for the highest access-right granted to
- * @cred. The caller should really cache those as policy lookups are rather
- * expensive.
+ * @creds. The caller should really cache those as policy lookups are rather
+ * expensive. The generation of @db can be used to invalidate such caches.
  *
  * Return: The highest KDBUS_POLICY_* access type found, or -EPERM if none.
  */
-int kdbus_policy_query(struct kdbus_policy_db *db, const struct cred *cred,
+int kdbus_policy_query(struct kdbus_policy_db *db,
+		       const struct kdbus_policy_creds *creds,
 		       const char *name, unsigned int hash)
 {
 	int ret;
 
-	down_read(&db->entries_rwlock);
-	ret = kdbus_policy_query_unlocked(db, cred, name, hash);
-	up_read(&db->entries_rwlock);
+	rcu_read_lock();
+	ret = kdbus_policy_query_unlocked(db, creds, name, hash);
+	rcu_read_unlock();
 
 	return ret;
 }
 
-static void __kdbus_policy_remove_owner(struct kdbus_policy_db *db,
-					const void *owner)
+/**
+ * kdbus_policy_snapshot_get() - pin the current snapshot of a policy database
+ * @db:		Policy database
+ *
+ * Queries on the returned snapshot see the same entries, no matter how @db
+ * changes in the meantime. Entries removed from @db while the memory for a
+ * new snapshot cannot be allocated are the exception, they also disappear
+ * from the pinned snapshot.
+ *
+ * Return: The referenced snapshot, or NULL if @db has no entries.
+ */
+struct kdbus_policy_snapshot *
+kdbus_policy_snapshot_get(struct kdbus_policy_db *db)
 {
-	struct kdbus_policy_db_entry *e;
-	struct hlist_node *tmp;
-	int i;
+	struct kdbus_policy_snapshot *snap;
 
-	hash_for_each_safe(db->entries_hash, i, tmp, e, hentry)
-		if (e->owner == owner) {
-			hash_del(&e->hentry);
-			kdbus_policy_entry_free(e);
-		}
+	rcu_read_lock();
+	do {
+		/* a snapshot without references is about to be replaced */
+		snap = rcu_dereference(db->snapshot);
+	} while (snap && !kref_get_unless_zero(&snap->kref));
+	rcu_read_unlock();
+
+	return snap;
+}
+
+/**
+ * kdbus_policy_snapshot_unref() - drop a reference of a policy snapshot
+ * @snap:	Snapshot, may be %NULL
+ *
+ * Return: NULL
+ */
+struct kdbus_policy_snapshot *
+kdbus_policy_snapshot_unref(struct kdbus_policy_snapshot *snap)
+{
+	if (snap)
+		kref_put(&snap->kref, __kdbus_policy_snapshot_free);
+	return NULL;
+}
+
+/**
+ * kdbus_policy_snapshot_query() - Query a pinned policy snapshot
+ * @snap:	Snapshot returned by kdbus_policy_snapshot_get(), may be %NULL
+ * @creds:	Credentials to test against
+ * @name:	Name to query
+ * @hash:	Hash value of @name
+ *
+ * Same as kdbus_policy_query(), but on the entries of @snap.
+ *
+ * Return: The highest KDBUS_POLICY_* access type found, or -EPERM if none.
+ */
+int kdbus_policy_snapshot_query(const struct kdbus_policy_snapshot *snap,
+				const struct kdbus_policy_creds *creds,
+				const char *name, unsigned int hash)
+{
+	int ret;
+
+	rcu_read_lock();
+	ret = kdbus_policy_snapshot_query_unlocked(snap, creds, name, hash);
+	rcu_read_unlock();
+
+	return ret;
 }
 
 /**
@@ -254,9 +670,64 @@ static void __kdbus_policy_remove_owner(struct kdbus_policy_db *db,
 void kdbus_policy_remove_owner(struct kdbus_policy_db *db,
 			       const void *owner)
 {
-	down_write(&db->entries_rwlock);
-	__kdbus_policy_remove_owner(db, owner);
-	up_write(&db->entries_rwlock);
+	struct kdbus_policy_snapshot *old, *snap;
+	struct kdbus_policy_db_entry *e;
+	LIST_HEAD(entries);
+	LIST_HEAD(removed);
+	unsigned int i;
+
+	mutex_lock(&db->entries_lock);
+
+	old = rcu_dereference_protected(db->snapshot,
+					lockdep_is_held(&db->entries_lock));
+	if (!old)
+		goto exit_unlock;
+
+	for (i = 0; i <= old->mask; i++)
+		if (kdbus_policy_entry_live(old->slots[i]) &&
+		    old->slots[i]->owner == owner)
+			break;
+
+	/* nothing to remove */
+	if (i > old->mask)
+		goto exit_unlock;
+
+	snap = kdbus_policy_snapshot_new(old, owner, &entries);
+	if (!IS_ERR(snap)) {
+		kdbus_policy_publish(db, snap);
+		goto exit_unlock;
+	}
+
+	/*
+	 * We must not fail to remove the entries, so if there is no memory
+	 * for a new snapshot, replace them in the published one. Readers
+	 * may briefly see only some of them removed.
+	 */
+	for (i = 0; i <= old->mask; i++) {
+		e = old->slots[i];
+		if (kdbus_policy_entry_live(e) && e->owner == owner) {
+			ACCESS_ONCE(old->slots[i]) = &kdbus_policy_tombstone;
+			list_add_tail(&e->set_entry, &removed);
+		}
+	}
+
+	smp_mb__before_atomic();
+	atomic_inc(&db->generation);
+	mutex_unlock(&db->entries_lock);
+
+	synchronize_rcu();
+
+	while (!list_empty(&removed)) {
+		e = list_first_entry(&removed, struct kdbus_policy_db_entry,
+				     set_entry);
+		list_del(&e->set_entry);
+		kdbus_policy_entry_unref(e);
+	}
+
+	return;
+
+exit_unlock:
+	mutex_unlock(&db->entries_lock);
 }
 
 /*
@@ -346,15 +817,13 @@ int kdbus_policy_set(struct kdbus_policy_db *db,
 		     bool allow_wildcards,
 		     const void *owner)
 {
+	struct kdbus_policy_snapshot *old, *snap;
 	struct kdbus_policy_db_entry_access *a;
-	struct kdbus_policy_db_entry *e, *p;
+	struct kdbus_policy_db_entry *e, *tmp;
 	const struct kdbus_item *item;
-	struct hlist_node *tmp;
-	HLIST_HEAD(entries);
-	HLIST_HEAD(restore);
+	LIST_HEAD(entries);
 	size_t count = 0;
-	int i, ret = 0;
-	u32 hash;
+	int ret = 0;
 
 	if (items_size > KDBUS_POLICY_MAX_SIZE)
 		return -E2BIG;
@@ -382,9 +851,10 @@ int kdbus_policy_set(struct kdbus_policy_db *db,
 				goto exit;
 			}
 
+			kref_init(&e->kref);
 			INIT_LIST_HEAD(&e->access_list);
 			e->owner = owner;
-			hlist_add_head(&e->hentry, &entries);
+			list_add_tail(&e->set_entry, &entries);
 
 			e->name = kstrdup(item->str, GFP_KERNEL);
 			if (!e->name) {
@@ -410,6 +880,7 @@ int kdbus_policy_set(struct kdbus_policy_db *db,
 				e->wildcard = true;
 			}
 
+			e->hash = kdbus_strhash(e->name);
 			break;
 		}
 
@@ -430,51 +901,32 @@ int kdbus_policy_set(struct kdbus_policy_db *db,
 		}
 	}
 
-	down_write(&db->entries_rwlock);
-
-	/* remember previous entries to restore in case of failure */
-	hash_for_each_safe(db->entries_hash, i, tmp, e, hentry)
-		if (e->owner == owner) {
-			hash_del(&e->hentry);
-			hlist_add_head(&e->hentry, &restore);
-		}
-
-	hlist_for_each_entry_safe(e, tmp, &entries, hentry) {
-		/* prevent duplicates */
-		hash = kdbus_strhash(e->name);
-		hash_for_each_possible(db->entries_hash, p, hentry, hash)
-			if (strcmp(e->name, p->name) == 0 &&
-			    e->wildcard == p->wildcard) {
-				ret = -EEXIST;
-				goto restore;
-			}
-
-		hlist_del(&e->hentry);
-		hash_add(db->entries_hash, &e->hentry, hash);
+	list_for_each_entry(e, &entries, set_entry) {
+		ret = kdbus_policy_entry_compile(e);
+		if (ret < 0)
+			goto exit;
 	}
 
-restore:
-	/* if we failed, flush all entries we added so far */
-	if (ret < 0)
-		__kdbus_policy_remove_owner(db, owner);
+	/*
+	 * Replace all previous entries of @owner at once, by publishing a new
+	 * snapshot. If we fail, the current snapshot stays untouched.
+	 */
+	mutex_lock(&db->entries_lock);
 
-	/* if we failed, restore entries, otherwise release them */
-	hlist_for_each_entry_safe(e, tmp, &restore, hentry) {
-		hlist_del(&e->hentry);
-		if (ret < 0) {
-			hash = kdbus_strhash(e->name);
-			hash_add(db->entries_hash, &e->hentry, hash);
-		} else {
-			kdbus_policy_entry_free(e);
-		}
-	}
+	old = rcu_dereference_protected(db->snapshot,
+					lockdep_is_held(&db->entries_lock));
+	snap = kdbus_policy_snapshot_new(old, owner, &entries);
+	if (IS_ERR(snap))
+		ret = PTR_ERR(snap);
+	else
+		kdbus_policy_publish(db, snap);
 
-	up_write(&db->entries_rwlock);
+	mutex_unlock(&db->entries_lock);
 
 exit:
-	hlist_for_each_entry_safe(e, tmp, &entries, hentry) {
-		hlist_del(&e->hentry);
-		kdbus_policy_entry_free(e);
+	list_for_each_entry_safe(e, tmp, &entries, set_entry) {
+		list_del(&e->set_entry);
+		kdbus_policy_entry_unref(e);
 	}
 
 	return ret;
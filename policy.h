@@ -14,31 +14,98 @@
 #ifndef __KDBUS_POLICY_H
 #define __KDBUS_POLICY_H
 
-#include <linux/hashtable.h>
-#include <linux/rwsem.h>
+#include <linux/atomic.h>
+#include <linux/cred.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+#include "limits.h"
 
 struct kdbus_conn;
 struct kdbus_item;
+struct kdbus_policy_snapshot;
 
 /**
  * struct kdbus_policy_db - policy database
- * @entries_hash:	Hashtable of entries
- * @entries_lock:	Mutex to protect the database's access entries
+ * @snapshot:		Current set of entries, or NULL if there are none
+ * @entries_lock:	Mutex to serialize replacing @snapshot
+ * @generation:		Incremented whenever the entries change
+ *
+ * Queries run lock-free under rcu_read_lock(), on the snapshot that was
+ * current when they started.
  */
 struct kdbus_policy_db {
-	DECLARE_HASHTABLE(entries_hash, 6);
-	struct rw_semaphore entries_rwlock;
+	struct kdbus_policy_snapshot __rcu *snapshot;
+	struct mutex entries_lock;
+	atomic_t generation;
+};
+
+/**
+ * struct kdbus_policy_creds - credentials as seen by policy queries
+ * @euid:		Effective uid
+ * @egid:		Effective gid
+ * @group_info:		Supplementary groups, sorted by gid. Not referenced,
+ *			the credentials this was built from must outlive it.
+ * @groups_bloom:	Bloom filter of @egid and all gids in @group_info
+ *
+ * Built once by kdbus_policy_creds_init(), so queries need not walk the
+ * supplementary groups for entries without matching GROUP rules.
+ */
+struct kdbus_policy_creds {
+	kuid_t euid;
+	kgid_t egid;
+	struct group_info *group_info;
+	u64 groups_bloom;
+};
+
+/**
+ * struct kdbus_policy_cache - per-connection cache of policy decisions
+ * @lock:			Cache lock
+ * @slots:			Cached decisions, indexed by peer and access
+ * @slots.peer_id:		ID of the peer, or 0 if the slot is unused
+ * @slots.access:		KDBUS_POLICY_* access that was checked
+ * @slots.ep_generation:	Generation of the endpoint policy database
+ * @slots.bus_generation:	Generation of the bus policy database
+ * @slots.names_generation:	Generation of the peer's names
+ * @slots.pass:			Whether access was granted
+ *
+ * A decision is valid as long as none of the policy databases it was
+ * derived from changed, and the peer did not gain or lose a name.
+ */
+struct kdbus_policy_cache {
+	spinlock_t lock;
+	struct {
+		u64 peer_id;
+		unsigned int access;
+		unsigned int ep_generation;
+		unsigned int bus_generation;
+		unsigned int names_generation;
+		bool pass;
+	} slots[1 << KDBUS_CONN_POLICY_CACHE_BITS];
 };
 
 void kdbus_policy_db_init(struct kdbus_policy_db *db);
 void kdbus_policy_db_clear(struct kdbus_policy_db *db);
 
+void kdbus_policy_creds_init(struct kdbus_policy_creds *creds,
+			     const struct cred *cred);
+
 int kdbus_policy_query_unlocked(struct kdbus_policy_db *db,
-				const struct cred *cred, const char *name,
-				unsigned int hash);
-int kdbus_policy_query(struct kdbus_policy_db *db, const struct cred *cred,
+				const struct kdbus_policy_creds *creds,
+				const char *name, unsigned int hash);
+int kdbus_policy_query(struct kdbus_policy_db *db,
+		       const struct kdbus_policy_creds *creds,
 		       const char *name, unsigned int hash);
 
+struct kdbus_policy_snapshot *
+kdbus_policy_snapshot_get(struct kdbus_policy_db *db);
+struct kdbus_policy_snapshot *
+kdbus_policy_snapshot_unref(struct kdbus_policy_snapshot *snap);
+int kdbus_policy_snapshot_query(const struct kdbus_policy_snapshot *snap,
+				const struct kdbus_policy_creds *creds,
+				const char *name, unsigned int hash);
+
 void kdbus_policy_remove_owner(struct kdbus_policy_db *db,
 			       const void *owner);
 int kdbus_policy_set(struct kdbus_policy_db *db,
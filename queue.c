@@ -13,11 +13,13 @@
  */
 
 #include <linux/audit.h>
+#include <linux/bitmap.h>
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/hashtable.h>
 #include <linux/idr.h>
 #include <linux/init.h>
+#include <linux/llist.h>
 #include <linux/math64.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -38,13 +40,54 @@
 #include "queue.h"
 #include "reply.h"
 
+/* messages accounted on a user form a flow per user, all others share one */
+static struct kdbus_queue_flow *
+kdbus_queue_entry_flow(struct kdbus_queue *queue,
+		       struct kdbus_queue_entry *entry)
+{
+	return entry->user ? &entry->user->flow : &queue->anon_flow;
+}
+
+/* bucket of a priority, or -1 if it is kept in the tree */
+static int kdbus_queue_prio_bucket(s64 priority)
+{
+	if (priority < KDBUS_QUEUE_PRIO_BUCKET_MIN ||
+	    priority >= KDBUS_QUEUE_PRIO_BUCKET_MIN + KDBUS_QUEUE_PRIO_BUCKETS)
+		return -1;
+
+	return priority - KDBUS_QUEUE_PRIO_BUCKET_MIN;
+}
+
+/* entry with the highest priority, the oldest one among equals */
+static struct kdbus_queue_entry *
+kdbus_queue_entry_highest(struct kdbus_queue *queue)
+{
+	struct kdbus_queue_entry *e = NULL;
+	unsigned long bucket;
+
+	/* priorities above the buckets are only kept in the tree */
+	if (queue->msg_prio_highest) {
+		e = rb_entry(queue->msg_prio_highest,
+			     struct kdbus_queue_entry, prio_node);
+		if (e->msg.priority < KDBUS_QUEUE_PRIO_BUCKET_MIN)
+			return e;
+	}
+
+	bucket = find_first_bit(queue->prio_bitmap, KDBUS_QUEUE_PRIO_BUCKETS);
+	if (bucket < KDBUS_QUEUE_PRIO_BUCKETS)
+		return list_first_entry(&queue->prio_buckets[bucket],
+					struct kdbus_queue_entry, prio_entry);
+
+	return e;
+}
+
 /**
  * kdbus_queue_entry_add() - Add an queue entry to a queue
  * @queue:	The queue to attach the item to
  * @entry:	The entry to attach
  *
  * Adds a previously allocated queue item to a queue, and maintains the
- * priority r/b tree.
+ * priority buckets and r/b tree. The caller must hold the queue lock.
  */
 /* add queue entry to connection, maintain priority queue */
 void kdbus_queue_entry_add(struct kdbus_queue *queue,
@@ -52,6 +95,17 @@ void kdbus_queue_entry_add(struct kdbus_queue *queue,
 {
 	struct rb_node **n, *pn = NULL;
 	bool highest = true;
+	int bucket;
+
+	/* common priorities are queued in constant time */
+	bucket = kdbus_queue_prio_bucket(entry->msg.priority);
+	if (likely(bucket >= 0)) {
+		RB_CLEAR_NODE(&entry->prio_node);
+		list_add_tail(&entry->prio_entry,
+			      &queue->prio_buckets[bucket]);
+		__set_bit(bucket, queue->prio_bitmap);
+		goto prio_done;
+	}
 
 	/* sort into priority entry tree */
 	n = &queue->msg_prio_queue.rb_node;
@@ -62,7 +116,8 @@ void kdbus_queue_entry_add(struct kdbus_queue *queue,
 		e = rb_entry(pn, struct kdbus_queue_entry, prio_node);
 
 		/* existing node for this priority, add to its list */
-		if (likely(entry->msg.priority == e->msg.priority)) {
+		if (entry->msg.priority == e->msg.priority) {
+			RB_CLEAR_NODE(&entry->prio_node);
 			list_add_tail(&entry->prio_entry, &e->prio_entry);
 			goto prio_done;
 		}
@@ -88,6 +143,78 @@ prio_done:
 	/* add to unsorted fifo list */
 	list_add_tail(&entry->entry, &queue->msg_list);
 	queue->msg_count++;
+
+	if (queue->fair) {
+		struct kdbus_queue_flow *flow;
+
+		flow = kdbus_queue_entry_flow(queue, entry);
+		if (list_empty(&flow->msg_list))
+			list_add_tail(&flow->entry, &queue->flow_list);
+		list_add_tail(&entry->flow_entry, &flow->msg_list);
+	}
+}
+
+/**
+ * kdbus_queue_entry_push() - Add an entry to a queue without locking it
+ * @queue:	The queue to push the entry to
+ * @entry:	The entry to push
+ * @max_msgs:	Number of queued messages at which the push fails
+ * @first:	Set to true if the queue held no messages before, false
+ *		otherwise
+ *
+ * Pushes a previously allocated queue item to the list of pending messages,
+ * from where it is spliced into the queue by the next holder of the queue
+ * lock. Many senders can push to the same queue without serializing on its
+ * lock. Entries must not be accounted on a user, so this must not be used
+ * for fair queues. As the queue lock is not taken, the caller has to check
+ * whether the receiver is still active after pushing the entry.
+ *
+ * Return: true if the entry was pushed, false if the queue already holds
+ * @max_msgs messages.
+ */
+bool kdbus_queue_entry_push(struct kdbus_queue *queue,
+			    struct kdbus_queue_entry *entry,
+			    size_t max_msgs, bool *first)
+{
+	size_t n;
+
+	n = atomic_inc_return(&queue->msg_pending_count);
+	if (n + ACCESS_ONCE(queue->msg_count) > max_msgs) {
+		atomic_dec(&queue->msg_pending_count);
+		return false;
+	}
+
+	/*
+	 * llist_add() and llist_del_all() imply full barriers, so either the
+	 * receiver sees this entry when it splices, or we see the entries it
+	 * has not yet received.
+	 */
+	*first = llist_add(&entry->pending_node, &queue->msg_pending) &&
+		 ACCESS_ONCE(queue->msg_count) == 0;
+	return true;
+}
+
+/**
+ * kdbus_queue_splice() - Add pending entries to a queue
+ * @queue:	The queue
+ *
+ * Adds all entries pushed by kdbus_queue_entry_push() to the queue, oldest
+ * first. This has to be done before the queue is inspected; the caller must
+ * hold the queue lock.
+ */
+void kdbus_queue_splice(struct kdbus_queue *queue)
+{
+	struct kdbus_queue_entry *entry, *tmp;
+	struct llist_node *first;
+
+	if (llist_empty(&queue->msg_pending))
+		return;
+
+	first = llist_reverse_order(llist_del_all(&queue->msg_pending));
+	llist_for_each_entry_safe(entry, tmp, first, pending_node) {
+		kdbus_queue_entry_add(queue, entry);
+		atomic_dec(&queue->msg_pending_count);
+	}
 }
 
 /**
@@ -98,6 +225,8 @@ prio_done:
  * @use_priority:	Boolean flag whether or not to peek by priority
  *
  * Look for a entry in a queue, either by priority, or the oldest one (FIFO).
+ * In fair queues, the oldest entry of the flow next in turn is returned
+ * instead of the oldest one overall.
  * The entry is not freed, put off the queue's lists or anything else.
  *
  * Return: the peeked queue entry on success, ERR_PTR(-ENOMSG) if there is no
@@ -115,12 +244,19 @@ struct kdbus_queue_entry *kdbus_queue_entry_peek(struct kdbus_queue *queue,
 
 	if (use_priority) {
 		/* get next entry with highest priority */
-		e = rb_entry(queue->msg_prio_highest,
-			     struct kdbus_queue_entry, prio_node);
+		e = kdbus_queue_entry_highest(queue);
 
 		/* no entry with the requested priority */
 		if (e->msg.priority > priority)
 			return ERR_PTR(-ENOMSG);
+	} else if (queue->fair) {
+		struct kdbus_queue_flow *flow;
+
+		/* return the next entry of the flow next in turn */
+		flow = list_first_entry(&queue->flow_list,
+					struct kdbus_queue_flow, entry);
+		e = list_first_entry(&flow->msg_list,
+				     struct kdbus_queue_entry, flow_entry);
 	} else {
 		/* ignore the priority, return the next entry in the entry */
 		e = list_first_entry(&queue->msg_list,
@@ -135,31 +271,51 @@ struct kdbus_queue_entry *kdbus_queue_entry_peek(struct kdbus_queue *queue,
  * @conn:	The connection containing the queue
  * @entry:	The entry to remove
  *
- * Remove an entry from both the queue's list and the priority r/b tree.
+ * Remove an entry from both the queue's list and the priority bucket or r/b
+ * tree, and wake up senders waiting for room in the queue. The caller must
+ * hold the queue lock.
  */
 void kdbus_queue_entry_remove(struct kdbus_conn *conn,
 			      struct kdbus_queue_entry *entry)
 {
 	struct kdbus_queue *queue = &conn->queue;
+	int bucket;
 
 	list_del(&entry->entry);
 	queue->msg_count--;
 
-	/* user quota */
-	if (entry->user) {
-		BUG_ON(conn->msg_users[entry->user->idr] == 0);
-		conn->msg_users[entry->user->idr]--;
-		entry->user = kdbus_domain_user_unref(entry->user);
+	if (queue->fair) {
+		struct kdbus_queue_flow *flow;
+		bool first;
+
+		/*
+		 * Once a flow got its oldest entry de-queued, it is the turn
+		 * of the next flow.
+		 */
+		flow = kdbus_queue_entry_flow(queue, entry);
+		first = flow->msg_list.next == &entry->flow_entry;
+		list_del(&entry->flow_entry);
+		if (list_empty(&flow->msg_list))
+			list_del_init(&flow->entry);
+		else if (first)
+			list_move_tail(&flow->entry, &queue->flow_list);
 	}
 
-	/* the queue is empty, remove the user quota accounting */
-	if (queue->msg_count == 0 && conn->msg_users_max > 0) {
-		kfree(conn->msg_users);
-		conn->msg_users = NULL;
-		conn->msg_users_max = 0;
+	/* user quota */
+	if (entry->user) {
+		kdbus_conn_user_uncharge(conn, entry->user);
+		entry->user = NULL;
 	}
 
-	if (list_empty(&entry->prio_entry)) {
+	bucket = kdbus_queue_prio_bucket(entry->msg.priority);
+	if (likely(bucket >= 0)) {
+		list_del(&entry->prio_entry);
+		if (list_empty(&queue->prio_buckets[bucket]))
+			__clear_bit(bucket, queue->prio_bitmap);
+	} else if (RB_EMPTY_NODE(&entry->prio_node)) {
+		/* not the oldest entry of its priority, not in the tree */
+		list_del(&entry->prio_entry);
+	} else if (list_empty(&entry->prio_entry)) {
 		/*
 		 * Single entry for this priority, update cached
 		 * highest-priority entry, remove the tree node.
@@ -186,6 +342,8 @@ void kdbus_queue_entry_remove(struct kdbus_conn *conn,
 		rb_replace_node(&entry->prio_node, &q->prio_node,
 				&queue->msg_prio_queue);
 	}
+
+	kdbus_conn_space_released(conn);
 }
 
 /**
@@ -392,7 +550,8 @@ int kdbus_queue_entry_install(struct kdbus_queue_entry *entry,
 		meta_items = kdbus_meta_export(entry->proc_meta,
 					       entry->conn_meta,
 					       attach_flags,
-					       &meta_size);
+					       &meta_size,
+					       conn_dst->ep->bus);
 		if (IS_ERR(meta_items)) {
 			ret = PTR_ERR(meta_items);
 			meta_items = NULL;
@@ -494,12 +653,34 @@ void kdbus_queue_entry_free(struct kdbus_queue_entry *entry)
 	kfree(entry);
 }
 
+/**
+ * kdbus_queue_flow_init() - initialize a flow of a fair queue
+ * @flow:	The flow to initialize
+ */
+void kdbus_queue_flow_init(struct kdbus_queue_flow *flow)
+{
+	INIT_LIST_HEAD(&flow->entry);
+	INIT_LIST_HEAD(&flow->msg_list);
+}
+
 /**
  * kdbus_queue_init() - initialize data structure related to a queue
  * @queue:	The queue to initialize
+ * @fair:	Whether to de-queue messages round-robin across senders
  */
-void kdbus_queue_init(struct kdbus_queue *queue)
+void kdbus_queue_init(struct kdbus_queue *queue, bool fair)
 {
+	unsigned int i;
+
+	mutex_init(&queue->lock);
 	INIT_LIST_HEAD(&queue->msg_list);
 	queue->msg_prio_queue = RB_ROOT;
+	for (i = 0; i < KDBUS_QUEUE_PRIO_BUCKETS; i++)
+		INIT_LIST_HEAD(&queue->prio_buckets[i]);
+	bitmap_zero(queue->prio_bitmap, KDBUS_QUEUE_PRIO_BUCKETS);
+	queue->fair = fair;
+	INIT_LIST_HEAD(&queue->flow_list);
+	kdbus_queue_flow_init(&queue->anon_flow);
+	init_llist_head(&queue->msg_pending);
+	atomic_set(&queue->msg_pending_count, 0);
 }
@@ -15,28 +15,69 @@
 #ifndef __KDBUS_QUEUE_H
 #define __KDBUS_QUEUE_H
 
-struct kdbus_domain_user;
+#include <linux/llist.h>
+
+#include "limits.h"
+
+struct kdbus_conn_user;
+
+/**
+ * struct kdbus_queue_flow - messages of one sender in a fair queue
+ * @entry:		Entry in the queue's round-robin list of flows, while
+ *			@msg_list is not empty
+ * @msg_list:		Queued messages of this flow, oldest first
+ */
+struct kdbus_queue_flow {
+	struct list_head entry;
+	struct list_head msg_list;
+};
 
 /**
  * struct kdbus_queue - a connection's message queue
- * @msg_count		Number of messages in the queue
+ * @lock:		Queue lock, nests inside the connection lock
+ * @msg_count		Number of messages in the queue, not counting
+ *			@msg_pending
  * @msg_list:		List head for kdbus_queue_entry objects
- * @msg_prio_queue:	RB tree root for messages, sorted by priority
+ * @msg_prio_queue:	RB tree root for messages whose priority has no
+ *			bucket, sorted by priority
  * @msg_prio_highest:	Link to the RB node referencing the message with the
  *			highest priority in the tree.
+ * @prio_buckets:	Messages with a priority of KDBUS_QUEUE_PRIO_BUCKET_MIN
+ *			and the following KDBUS_QUEUE_PRIO_BUCKETS - 1 values,
+ *			one FIFO list per priority
+ * @prio_bitmap:	Non-empty lists in @prio_buckets
+ * @fair:		Whether messages are de-queued round-robin across
+ *			flows, rather than from @msg_list
+ * @flow_list:		Flows with queued messages, in round-robin order
+ * @anon_flow:		Flow of the messages not accounted on a user
+ * @msg_pending:	Messages pushed without taking @lock, newest first,
+ *			which are yet to be spliced into the queue
+ * @msg_pending_count:	Number of messages in @msg_pending
  */
 struct kdbus_queue {
+	struct mutex lock;
 	size_t msg_count;
 	struct list_head msg_list;
 	struct rb_root msg_prio_queue;
 	struct rb_node *msg_prio_highest;
+	struct list_head prio_buckets[KDBUS_QUEUE_PRIO_BUCKETS];
+	DECLARE_BITMAP(prio_bitmap, KDBUS_QUEUE_PRIO_BUCKETS);
+	bool fair;
+	struct list_head flow_list;
+	struct kdbus_queue_flow anon_flow;
+	struct llist_head msg_pending;
+	atomic_t msg_pending_count;
 };
 
 /**
  * struct kdbus_queue_entry - messages waiting to be read
  * @entry:		Entry in the connection's list
- * @prio_node:		Entry in the priority queue tree
- * @prio_entry:		Queue tree node entry in the list of one priority
+ * @prio_node:		Entry in the priority queue tree, if the entry is the
+ *			oldest one of a priority without bucket
+ * @prio_entry:		Entry in the list of one priority, either in a bucket
+ *			or headed by the tree node
+ * @flow_entry:		Entry in the list of the flow, in fair queues
+ * @pending_node:	Entry in the list of pending messages
  * @msg:		Message header, either as received from userspace
  *			process, or as crafted by the kernel as notification
  * @msg_extra:		For notifications, contains more fixed parts of a
@@ -59,12 +100,15 @@ struct kdbus_queue {
  * @proc_meta:		Process metadata, captured at message arrival
  * @conn_meta:		Connection metadata, captured at message arrival
  * @reply:		The reply block if a reply to this message is expected.
- * @user:		Index in per-user message counter, -1 for unused
+ * @user:		Per-user message counter of the receiver this entry
+ *			is accounted on, or NULL
  */
 struct kdbus_queue_entry {
 	struct list_head entry;
 	struct rb_node prio_node;
 	struct list_head prio_entry;
+	struct list_head flow_entry;
+	struct llist_node pending_node;
 
 	struct kdbus_msg msg;
 
@@ -80,12 +124,13 @@ struct kdbus_queue_entry {
 	struct kdbus_meta_proc *proc_meta;
 	struct kdbus_meta_conn *conn_meta;
 	struct kdbus_reply *reply;
-	struct kdbus_domain_user *user;
+	struct kdbus_conn_user *user;
 };
 
 struct kdbus_kmsg;
 
-void kdbus_queue_init(struct kdbus_queue *queue);
+void kdbus_queue_flow_init(struct kdbus_queue_flow *flow);
+void kdbus_queue_init(struct kdbus_queue *queue, bool fair);
 
 struct kdbus_queue_entry *
 kdbus_queue_entry_alloc(struct kdbus_pool *pool,
@@ -98,6 +143,10 @@ void kdbus_queue_entry_add(struct kdbus_queue *queue,
 			   struct kdbus_queue_entry *entry);
 void kdbus_queue_entry_remove(struct kdbus_conn *conn,
 			      struct kdbus_queue_entry *entry);
+bool kdbus_queue_entry_push(struct kdbus_queue *queue,
+			    struct kdbus_queue_entry *entry,
+			    size_t max_msgs, bool *first);
+void kdbus_queue_splice(struct kdbus_queue *queue);
 struct kdbus_queue_entry *kdbus_queue_entry_peek(struct kdbus_queue *queue,
 						 s64 priority,
 						 bool use_priority);
@@ -1,9 +1,13 @@
+#include <linux/hashtable.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
 #include <linux/uio.h>
+#include <linux/workqueue.h>
 
 #include "bus.h"
 #include "connection.h"
@@ -17,12 +21,37 @@
 #include "reply.h"
 #include "util.h"
 
+/* reply trackers are allocated for every method call */
+static struct kmem_cache *kdbus_reply_cache;
+
+/**
+ * kdbus_reply_init() - Set up the cache for reply objects
+ *
+ * Return: 0 on success, negative errno on failure.
+ */
+int kdbus_reply_init(void)
+{
+	kdbus_reply_cache = KMEM_CACHE(kdbus_reply, 0);
+	if (!kdbus_reply_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/**
+ * kdbus_reply_exit() - Destroy the cache for reply objects
+ */
+void kdbus_reply_exit(void)
+{
+	kmem_cache_destroy(kdbus_reply_cache);
+}
+
 /**
  * kdbus_reply_new() - Allocate and set up a new kdbus_reply object
  * @reply_src:		The connection a reply is expected from
  * @reply_dst:		The connection this reply object belongs to
  * @msg:		Message associated with the reply
- * @name_entry:		Name entry used to send the message
+ * @name_id:		ID of the name entry used to send the message, or 0
  * @sync:		Whether or not to make this reply synchronous
  *
  * Allocate and fill a new kdbus_reply object.
@@ -32,7 +61,7 @@
 struct kdbus_reply *kdbus_reply_new(struct kdbus_conn *reply_src,
 				    struct kdbus_conn *reply_dst,
 				    const struct kdbus_msg *msg,
-				    struct kdbus_name_entry *name_entry,
+				    u64 name_id,
 				    bool sync)
 {
 	struct kdbus_reply *r;
@@ -44,7 +73,7 @@ struct kdbus_reply *kdbus_reply_new(struct kdbus_conn *reply_src,
 		goto exit_dec_request_count;
 	}
 
-	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	r = kmem_cache_zalloc(kdbus_reply_cache, GFP_KERNEL);
 	if (!r) {
 		ret = -ENOMEM;
 		goto exit_dec_request_count;
@@ -52,10 +81,11 @@ struct kdbus_reply *kdbus_reply_new(struct kdbus_conn *reply_src,
 
 	kref_init(&r->kref);
 	INIT_LIST_HEAD(&r->entry);
+	RB_CLEAR_NODE(&r->deadline_node);
 	r->reply_src = kdbus_conn_ref(reply_src);
 	r->reply_dst = kdbus_conn_ref(reply_dst);
 	r->cookie = msg->cookie;
-	r->name_id = name_entry ? name_entry->name_id : 0;
+	r->name_id = name_id;
 	r->deadline_ns = msg->timeout_ns;
 
 	if (sync) {
@@ -80,7 +110,7 @@ static void __kdbus_reply_free(struct kref *kref)
 	atomic_dec(&reply->reply_dst->request_count);
 	kdbus_conn_unref(reply->reply_src);
 	kdbus_conn_unref(reply->reply_dst);
-	kfree(reply);
+	kmem_cache_free(kdbus_reply_cache, reply);
 }
 
 /**
@@ -109,9 +139,78 @@ struct kdbus_reply *kdbus_reply_unref(struct kdbus_reply *r)
 	return NULL;
 }
 
+/* key of a reply in the reply_hash of the connection it is linked to */
+static u64 kdbus_reply_key(const struct kdbus_conn *reply_src, u64 cookie)
+{
+	return cookie ^ reply_src->id;
+}
+
+/**
+ * kdbus_reply_arm() - Let the connection's work handle the timeout of a reply
+ * @r:		Linked reply
+ *
+ * Insert @r into the deadline-ordered replies of the connection it is linked
+ * to. The work of the connection is only rescheduled if @r expires before
+ * all other replies.
+ *
+ * Callers must take the lock of the connection @r is linked to.
+ */
+void kdbus_reply_arm(struct kdbus_reply *r)
+{
+	struct kdbus_conn *conn = r->reply_dst;
+	struct rb_node **n, *parent = NULL;
+	bool leftmost = true;
+	u64 now;
+
+	if (list_empty(&r->entry) || !RB_EMPTY_NODE(&r->deadline_node))
+		return;
+
+	n = &conn->reply_deadlines.rb_node;
+	while (*n) {
+		struct kdbus_reply *pos;
+
+		parent = *n;
+		pos = rb_entry(parent, struct kdbus_reply, deadline_node);
+		if (r->deadline_ns < pos->deadline_ns) {
+			n = &parent->rb_left;
+		} else {
+			n = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	rb_link_node(&r->deadline_node, parent, n);
+	rb_insert_color(&r->deadline_node, &conn->reply_deadlines);
+
+	if (!leftmost)
+		return;
+
+	now = ktime_get_ns();
+	mod_delayed_work(system_wq, &conn->work,
+			 r->deadline_ns > now ?
+			 nsecs_to_jiffies(r->deadline_ns - now) : 0);
+}
+
+/**
+ * kdbus_reply_disarm() - Stop handling the timeout of a reply in the work
+ * @r:		Reply
+ *
+ * Callers must take the lock of the connection @r is linked to.
+ */
+void kdbus_reply_disarm(struct kdbus_reply *r)
+{
+	if (!RB_EMPTY_NODE(&r->deadline_node)) {
+		rb_erase(&r->deadline_node, &r->reply_dst->reply_deadlines);
+		RB_CLEAR_NODE(&r->deadline_node);
+	}
+}
+
 /**
  * kdbus_reply_link() - Link reply object into target connection
  * @r:		Reply to link
+ *
+ * The timeouts of asynchronous replies are armed right away, synchronous
+ * replies are timed out by their waiter.
  */
 void kdbus_reply_link(struct kdbus_reply *r)
 {
@@ -119,7 +218,12 @@ void kdbus_reply_link(struct kdbus_reply *r)
 		return;
 
 	list_add(&r->entry, &r->reply_dst->reply_list);
+	hash_add(r->reply_dst->reply_hash, &r->hentry,
+		 kdbus_reply_key(r->reply_src, r->cookie));
 	kdbus_reply_ref(r);
+
+	if (!r->sync)
+		kdbus_reply_arm(r);
 }
 
 /**
@@ -129,11 +233,32 @@ void kdbus_reply_link(struct kdbus_reply *r)
 void kdbus_reply_unlink(struct kdbus_reply *r)
 {
 	if (!list_empty(&r->entry)) {
+		kdbus_reply_disarm(r);
 		list_del_init(&r->entry);
+		hash_del(&r->hentry);
 		kdbus_reply_unref(r);
 	}
 }
 
+/**
+ * kdbus_reply_move_src() - Change the connection a reply is expected from
+ * @r:		Reply to change
+ * @reply_src:	New replying connection
+ *
+ * Callers must take the lock of the connection @r is linked to.
+ */
+void kdbus_reply_move_src(struct kdbus_reply *r, struct kdbus_conn *reply_src)
+{
+	kdbus_conn_unref(r->reply_src);
+	r->reply_src = kdbus_conn_ref(reply_src);
+
+	if (!list_empty(&r->entry)) {
+		hash_del(&r->hentry);
+		hash_add(r->reply_dst->reply_hash, &r->hentry,
+			 kdbus_reply_key(r->reply_src, r->cookie));
+	}
+}
+
 /**
  * kdbus_sync_reply_wakeup() - Wake a synchronously blocking reply
  * @reply:	The reply object
@@ -142,15 +267,23 @@ void kdbus_reply_unlink(struct kdbus_reply *r)
  * Remove the synchronous reply object from its connection reply_list, and
  * wake up remote peer (method origin) with the appropriate synchronous reply
  * code.
+ *
+ * Callers must take the lock of the reply_dst connection, which keeps the
+ * waiting task around until it was woken up.
  */
 void kdbus_sync_reply_wakeup(struct kdbus_reply *reply, int err)
 {
 	if (WARN_ON(!reply->sync))
 		return;
 
-	reply->waiting = false;
 	reply->err = err;
-	wake_up_interruptible(&reply->reply_dst->wait);
+	smp_wmb();
+	reply->waiting = false;
+
+	if (reply->waiter)
+		wake_up_process(reply->waiter);
+	else
+		wake_up_interruptible(&reply->reply_dst->wait);
 }
 
 /**
@@ -175,43 +308,37 @@ struct kdbus_reply *kdbus_reply_find(struct kdbus_conn *replying,
 				     struct kdbus_conn *reply_dst,
 				     u64 cookie)
 {
-	struct kdbus_reply *r, *reply = NULL;
+	struct kdbus_reply *r;
 
-	list_for_each_entry(r, &reply_dst->reply_list, entry) {
-		if (r->reply_src == replying &&
-		    r->cookie == cookie) {
-			reply = r;
-			break;
-		}
-	}
+	hash_for_each_possible(reply_dst->reply_hash, r, hentry,
+			       kdbus_reply_key(replying, cookie))
+		if (r->reply_src == replying && r->cookie == cookie)
+			return r;
 
-	return reply;
+	return NULL;
 }
 
 /**
- * kdbus_reply_list_scan_work() - Worker callback to scan the replies of a
- *				  connection for exceeded timeouts
+ * kdbus_reply_list_scan_work() - Worker callback to time out the replies of a
+ *				  connection
  * @work:		Work struct of the connection to scan
  *
- * Walk the list of replies stored with a connection and look for entries
- * that have exceeded their timeout. If such an entry is found, a timeout
- * notification is sent to the waiting peer, and the reply is removed from
- * the list.
+ * Take the replies with the earliest deadlines of a connection, until one
+ * is found that did not exceed its timeout. For the expired replies, a
+ * timeout notification is sent to the waiting peer, and the reply is
+ * removed from the list.
  *
- * The work is rescheduled to the nearest timeout found during the list
- * iteration.
+ * The work is rescheduled to the earliest deadline left.
  */
 void kdbus_reply_list_scan_work(struct work_struct *work)
 {
 	struct kdbus_conn *conn =
 		container_of(work, struct kdbus_conn, work.work);
-	struct kdbus_reply *reply, *reply_tmp;
-	u64 deadline = ~0ULL;
-	struct timespec64 ts;
+	struct kdbus_reply *reply;
+	struct rb_node *rb;
 	u64 now;
 
-	ktime_get_ts64(&ts);
-	now = timespec64_to_ns(&ts);
+	now = ktime_get_ns();
 
 	mutex_lock(&conn->lock);
 	if (!kdbus_conn_active(conn)) {
@@ -219,23 +346,20 @@ void kdbus_reply_list_scan_work(struct work_struct *work)
 		return;
 	}
 
-	list_for_each_entry_safe(reply, reply_tmp, &conn->reply_list, entry) {
-		/*
-		 * If the reply block is waiting for synchronous I/O,
-		 * the timeout is handled by wait_event_*_timeout(),
-		 * so we don't have to care for it here.
-		 */
-		if (reply->sync && !reply->interrupted)
-			continue;
+	/*
+	 * Replies waiting for synchronous I/O are not part of the deadlines,
+	 * their timeout is handled by the waiter, unless it got interrupted.
+	 */
+	while ((rb = rb_first(&conn->reply_deadlines))) {
+		reply = rb_entry(rb, struct kdbus_reply, deadline_node);
 
 		WARN_ON(reply->reply_dst != conn);
 
 		if (reply->deadline_ns > now) {
-			/* remember next timeout */
-			if (deadline > reply->deadline_ns)
-				deadline = reply->deadline_ns;
-
-			continue;
+			/* rearm delayed work with next timeout */
+			schedule_delayed_work(&conn->work,
+				nsecs_to_jiffies(reply->deadline_ns - now));
+			break;
 		}
 
 		/*
@@ -251,12 +375,7 @@ void kdbus_reply_list_scan_work(struct work_struct *work)
 		kdbus_reply_unlink(reply);
 	}
 
-	/* rearm delayed work with next timeout */
-	if (deadline != ~0ULL)
-		schedule_delayed_work(&conn->work,
-				      nsecs_to_jiffies(deadline - now));
-
 	mutex_unlock(&conn->lock);
 
-	kdbus_notify_flush(conn->ep->bus);
+	kdbus_notify_flush_deferred(conn->ep->bus);
 }
@@ -15,10 +15,15 @@
 #ifndef __KDBUS_REPLY_H
 #define __KDBUS_REPLY_H
 
+#include <linux/rbtree.h>
+
 /**
  * struct kdbus_reply - an entry of kdbus_conn's list of replies
  * @kref:		Ref-count of this object
  * @entry:		The entry of the connection's reply_list
+ * @hentry:		The entry of the connection's reply_hash
+ * @deadline_node:	The entry of the connection's reply_deadlines, while
+ *			the timeout is handled by the connection's work
  * @reply_src:		The connection the reply will be sent from
  * @reply_dst:		The connection the reply will be sent to
  * @queue_entry:	The queue entry item that is prepared by the replying
@@ -28,28 +33,37 @@
  * @name_id:		ID of the well-known name the original msg was sent to
  * @sync:		The reply block is waiting for synchronous I/O
  * @waiting:		The condition to synchronously wait for
+ * @waiter:		Task waiting for the sync reply without a cancel fd,
+ *			woken directly instead of through the wait queue of
+ *			@reply_dst
  * @interrupted:	The sync reply was left in an interrupted state
  * @err:		The error code for the synchronous reply
  */
 struct kdbus_reply {
 	struct kref kref;
 	struct list_head entry;
+	struct hlist_node hentry;
+	struct rb_node deadline_node;
 	struct kdbus_conn *reply_src;
 	struct kdbus_conn *reply_dst;
 	struct kdbus_queue_entry *queue_entry;
 	u64 deadline_ns;
 	u64 cookie;
 	u64 name_id;
+	struct task_struct *waiter;
 	bool sync:1;
 	bool waiting:1;
 	bool interrupted:1;
 	int err;
 };
 
+int kdbus_reply_init(void);
+void kdbus_reply_exit(void);
+
 struct kdbus_reply *kdbus_reply_new(struct kdbus_conn *reply_src,
 				    struct kdbus_conn *reply_dst,
 				    const struct kdbus_msg *msg,
-				    struct kdbus_name_entry *name_entry,
+				    u64 name_id,
 				    bool sync);
 
 struct kdbus_reply *kdbus_reply_ref(struct kdbus_reply *r);
@@ -57,6 +71,9 @@ struct kdbus_reply *kdbus_reply_unref(struct kdbus_reply *r);
 
 void kdbus_reply_link(struct kdbus_reply *r);
 void kdbus_reply_unlink(struct kdbus_reply *r);
+void kdbus_reply_arm(struct kdbus_reply *r);
+void kdbus_reply_disarm(struct kdbus_reply *r);
+void kdbus_reply_move_src(struct kdbus_reply *r, struct kdbus_conn *reply_src);
 
 struct kdbus_reply *kdbus_reply_find(struct kdbus_conn *replying,
 				     struct kdbus_conn *reply_dst,
@@ -64,6 +64,11 @@ TABLE(MSG) = {
 	ENUM(KDBUS_ITEM_ATTACH_FLAGS_RECV),
 	ENUM(KDBUS_ITEM_ID),
 	ENUM(KDBUS_ITEM_NAME),
+	ENUM(KDBUS_ITEM_BUSY_POLL),
+	ENUM(KDBUS_ITEM_QUEUE_DEPTH),
+	ENUM(KDBUS_ITEM_SEND_TIMEOUT),
+	ENUM(KDBUS_ITEM_NAME_LIST_CURSOR),
+	ENUM(KDBUS_ITEM_NAME_LIST_GENERATION),
 	ENUM(KDBUS_ITEM_TIMESTAMP),
 	ENUM(KDBUS_ITEM_CREDS),
 	ENUM(KDBUS_ITEM_PIDS),
@@ -85,6 +90,7 @@ TABLE(MSG) = {
 	ENUM(KDBUS_ITEM_ID_REMOVE),
 	ENUM(KDBUS_ITEM_REPLY_TIMEOUT),
 	ENUM(KDBUS_ITEM_REPLY_DEAD),
+	ENUM(KDBUS_ITEM_NAME_DELTA),
 };
 LOOKUP(MSG);
 
@@ -118,6 +118,12 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_name_queue,
 		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
 	},
+	{
+		.name	= "name-list",
+		.desc	= "paged and incremental name listing",
+		.func	= kdbus_test_name_list,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "message-basic",
 		.desc	= "basic message handling",
@@ -238,6 +244,12 @@ static const struct kdbus_test tests[] = {
 		.func	= kdbus_test_match_name_change,
 		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
 	},
+	{
+		.name	= "match-name-delta",
+		.desc	= "matching for coalesced name changes",
+		.func	= kdbus_test_match_name_delta,
+		.flags	= TEST_CREATE_BUS | TEST_CREATE_CONN,
+	},
 	{
 		.name	= "match-bloom",
 		.desc	= "matching with bloom filters",
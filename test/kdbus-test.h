@@ -63,6 +63,7 @@ int kdbus_test_match_id_remove(struct kdbus_test_env *env);
 int kdbus_test_match_replace(struct kdbus_test_env *env);
 int kdbus_test_match_name_add(struct kdbus_test_env *env);
 int kdbus_test_match_name_change(struct kdbus_test_env *env);
+int kdbus_test_match_name_delta(struct kdbus_test_env *env);
 int kdbus_test_match_name_remove(struct kdbus_test_env *env);
 int kdbus_test_message_basic(struct kdbus_test_env *env);
 int kdbus_test_message_prio(struct kdbus_test_env *env);
@@ -72,6 +73,7 @@ int kdbus_test_monitor(struct kdbus_test_env *env);
 int kdbus_test_name_basic(struct kdbus_test_env *env);
 int kdbus_test_name_conflict(struct kdbus_test_env *env);
 int kdbus_test_name_queue(struct kdbus_test_env *env);
+int kdbus_test_name_list(struct kdbus_test_env *env);
 int kdbus_test_policy(struct kdbus_test_env *env);
 int kdbus_test_policy_ns(struct kdbus_test_env *env);
 int kdbus_test_policy_priv(struct kdbus_test_env *env);
@@ -308,6 +308,64 @@ int kdbus_test_match_name_change(struct kdbus_test_env *env)
 	return TEST_OK;
 }
 
+int kdbus_test_match_name_delta(struct kdbus_test_env *env)
+{
+	struct {
+		struct kdbus_cmd_match cmd;
+		struct {
+			uint64_t size;
+			uint64_t type;
+		} item;
+	} buf;
+	static const char * const names[] = {
+		"foo.bla.blaz", "foo.bla.blub", "foo.bla.blob",
+	};
+	struct kdbus_conn *conn;
+	struct kdbus_item *item;
+	struct kdbus_msg *msg;
+	unsigned int i, n;
+	int ret;
+
+	/* create a 2nd connection owning some names */
+	conn = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(conn != NULL);
+
+	for (i = 0; i < ELEMENTSOF(names); i++) {
+		ret = kdbus_name_acquire(conn, names[i], NULL);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	/* install the match rule */
+	memset(&buf, 0, sizeof(buf));
+	buf.item.type = KDBUS_ITEM_NAME_DELTA;
+	buf.item.size = sizeof(buf.item);
+	buf.cmd.size = sizeof(buf);
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MATCH_ADD, &buf);
+	ASSERT_RETURN(ret == 0);
+
+	/* all names are dropped at once when the connection goes away */
+	kdbus_conn_free(conn);
+
+	/* we should have received exactly one notification */
+	ret = kdbus_msg_recv(env->conn, &msg, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	n = 0;
+	KDBUS_ITEM_FOREACH(item, msg, items) {
+		ASSERT_RETURN(item->type == KDBUS_ITEM_NAME_REMOVE);
+		ASSERT_RETURN(item->name_change.new_id.id == 0);
+		n++;
+	}
+
+	ASSERT_RETURN(n == ELEMENTSOF(names));
+
+	ret = kdbus_msg_recv(env->conn, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	return TEST_OK;
+}
+
 static int send_bloom_filter(const struct kdbus_conn *conn,
 			     uint64_t cookie,
 			     const uint8_t *filter,
@@ -8,8 +8,10 @@
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <stdbool.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -162,6 +164,16 @@ int kdbus_test_message_prio(struct kdbus_test_env *env)
 	kdbus_printf("--- get priority (all)\n");
 	ASSERT_RETURN(kdbus_msg_recv(a, NULL, NULL) == 0);
 
+	/* mix priorities with and without a bucket in the kernel */
+	ASSERT_RETURN(msg_recv_prio(a, 100, -35) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 100, -15) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 100, -10) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 15, 10) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 15, 10) == 0);
+	ASSERT_RETURN(msg_recv_prio(a, 15, 20) == -ENOMSG);
+	ASSERT_RETURN(msg_recv_prio(a, 100, 20) == 0);
+	ASSERT_RETURN(kdbus_msg_recv(a, NULL, NULL) == -EAGAIN);
+
 	kdbus_conn_free(a);
 	kdbus_conn_free(b);
 
@@ -264,6 +276,325 @@ static int kdbus_fill_conn_queue(struct kdbus_conn *conn_src,
 	return i;
 }
 
+static int kdbus_msg_send_wait_space(const struct kdbus_conn *conn_src,
+				     uint64_t cookie, uint64_t dst_id,
+				     uint64_t timeout_ns)
+{
+	struct {
+		struct kdbus_cmd_send cmd;
+		uint64_t timeout[KDBUS_ITEM_SIZE(sizeof(uint64_t)) / 8];
+	} send;
+	struct kdbus_msg msg;
+	int ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.size = sizeof(msg);
+	msg.dst_id = dst_id;
+	msg.src_id = conn_src->id;
+	msg.cookie = cookie;
+	msg.payload_type = KDBUS_PAYLOAD_DBUS;
+
+	memset(&send, 0, sizeof(send));
+	send.cmd.size = sizeof(send);
+	send.cmd.msg_address = (uintptr_t)&msg;
+	send.cmd.items[0].type = KDBUS_ITEM_SEND_TIMEOUT;
+	send.cmd.items[0].size = KDBUS_ITEM_SIZE(sizeof(uint64_t));
+	send.cmd.items[0].data64[0] = timeout_ns;
+
+	ret = ioctl(conn_src->fd, KDBUS_CMD_SEND, &send);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+static uint64_t now_plus_ns(uint64_t ns)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec + ns;
+}
+
+static int kdbus_test_queue_depth(struct kdbus_test_env *env)
+{
+	uint64_t buf[KDBUS_ITEM_SIZE(sizeof(uint64_t)) / 8];
+	struct kdbus_item *item = (struct kdbus_item *)buf;
+	struct kdbus_conn *a, *b;
+	unsigned int cnt, max_user_msgs;
+	uint64_t cookie = 0;
+	pid_t pid;
+	int ret, status;
+
+	item->type = KDBUS_ITEM_QUEUE_DEPTH;
+	item->size = KDBUS_ITEM_SIZE(sizeof(uint64_t));
+
+	/* the depth must be non-zero and bounded by the pool size */
+	item->data64[0] = 0;
+	a = kdbus_hello(env->buspath, 0, item, item->size);
+	ASSERT_RETURN(a == NULL);
+
+	item->data64[0] = POOL_SIZE / sizeof(struct kdbus_msg) + 1;
+	a = kdbus_hello(env->buspath, 0, item, item->size);
+	ASSERT_RETURN(a == NULL);
+
+	/* the per-user quota grows with the depth of the queue */
+	item->data64[0] = KDBUS_CONN_MAX_MSGS * 4;
+	a = kdbus_hello(env->buspath, 0, item, item->size);
+	ASSERT_RETURN(a);
+
+	b = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(b);
+
+	max_user_msgs = KDBUS_CONN_MAX_MSGS_UNACCOUNTED +
+			KDBUS_CONN_MAX_MSGS_PER_USER * 4;
+
+	cnt = kdbus_fill_conn_queue(b, a->id, max_user_msgs + 1);
+	ASSERT_RETURN(cnt == max_user_msgs);
+	cookie = cnt;
+
+	/* waiting for space times out with the original error */
+	ret = kdbus_msg_send_wait_space(b, ++cookie, a->id,
+					now_plus_ns(10000000ULL));
+	ASSERT_RETURN(ret == -ENOBUFS);
+
+	/* a blocked sender is woken up once the receiver dequeues */
+	pid = fork();
+	ASSERT_RETURN_VAL(pid >= 0, pid);
+
+	if (pid == 0) {
+		ret = kdbus_msg_send_wait_space(b, 0xdeadbeef, a->id,
+						now_plus_ns(5000000000ULL));
+		ASSERT_EXIT(ret == 0);
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	usleep(100 * 1000);
+
+	ret = kdbus_msg_recv(a, NULL, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = waitpid(pid, &status, 0);
+	ASSERT_RETURN(ret >= 0);
+	ASSERT_RETURN(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	/* the queue is full again, with the message of the child last */
+	ret = kdbus_msg_send(b, NULL, ++cookie, 0, 0, 0, a->id);
+	ASSERT_RETURN(ret == -ENOBUFS);
+
+	kdbus_conn_free(a);
+	kdbus_conn_free(b);
+
+	return TEST_OK;
+}
+
+static int kdbus_test_pollout(struct kdbus_test_env *env)
+{
+	struct pollfd fd;
+	struct kdbus_conn *a, *b;
+	unsigned int cnt;
+	int ret;
+
+	a = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(a);
+
+	b = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(b);
+
+	fd.fd = b->fd;
+	fd.events = POLLOUT;
+
+	ret = poll(&fd, 1, 0);
+	ASSERT_RETURN(ret == 1 && (fd.revents & POLLOUT));
+
+	cnt = kdbus_fill_conn_queue(b, a->id, MAX_USER_TOTAL_MSGS + 1);
+	ASSERT_RETURN(cnt == MAX_USER_TOTAL_MSGS);
+
+	/* the failed send makes the sender wait for its destination */
+	ret = poll(&fd, 1, 0);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_msg_recv(a, NULL, NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = poll(&fd, 1, 100);
+	ASSERT_RETURN(ret == 1 && (fd.revents & POLLOUT));
+
+	kdbus_conn_free(a);
+	kdbus_conn_free(b);
+
+	return TEST_OK;
+}
+
+/*
+ * Count the wakeups of a connection created with @hello_flags, while @n
+ * messages are queued on it after a first one. An edge-triggered epoll
+ * reports an event for every wakeup of the connection, even if the queue
+ * was not empty before. Returns the number of wakeups, or -1 on failure.
+ */
+static int kdbus_count_queue_wakeups(struct kdbus_test_env *env,
+				     uint64_t hello_flags, unsigned int n)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLET,
+	};
+	struct kdbus_conn *a, *b;
+	unsigned int i, cnt;
+	int ret, epfd, wakeups = 0;
+
+	a = kdbus_hello(env->buspath, hello_flags, NULL, 0);
+	ASSERT_RETURN_VAL(a, -1);
+
+	b = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN_VAL(b, -1);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	ASSERT_RETURN_VAL(epfd >= 0, -1);
+
+	ret = epoll_ctl(epfd, EPOLL_CTL_ADD, a->fd, &ev);
+	ASSERT_RETURN_VAL(ret == 0, -1);
+
+	/* the first message always wakes up the receiver */
+	cnt = kdbus_fill_conn_queue(b, a->id, 1);
+	ASSERT_RETURN_VAL(cnt == 1, -1);
+
+	ret = epoll_wait(epfd, &ev, 1, 100);
+	ASSERT_RETURN_VAL(ret == 1 && (ev.events & EPOLLIN), -1);
+
+	ret = epoll_wait(epfd, &ev, 1, 0);
+	ASSERT_RETURN_VAL(ret == 0, -1);
+
+	/* further messages, without draining the queue in between */
+	for (i = 0; i < n; i++) {
+		cnt = kdbus_fill_conn_queue(b, a->id, 1);
+		ASSERT_RETURN_VAL(cnt == 1, -1);
+
+		ret = epoll_wait(epfd, &ev, 1, 0);
+		ASSERT_RETURN_VAL(ret >= 0, -1);
+		wakeups += ret;
+	}
+
+	close(epfd);
+	kdbus_conn_free(a);
+	kdbus_conn_free(b);
+
+	return wakeups;
+}
+
+static int kdbus_test_coalesce_wakeup(struct kdbus_test_env *env)
+{
+	struct pollfd fd;
+	struct kdbus_conn *a, *b;
+	unsigned int i, cnt;
+	int ret;
+
+	a = kdbus_hello(env->buspath, KDBUS_HELLO_COALESCE_WAKEUP, NULL, 0);
+	ASSERT_RETURN(a);
+
+	b = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(b);
+
+	fd.fd = a->fd;
+	fd.events = POLLIN;
+
+	ret = poll(&fd, 1, 0);
+	ASSERT_RETURN(ret == 0);
+
+	cnt = kdbus_fill_conn_queue(b, a->id, 3);
+	ASSERT_RETURN(cnt == 3);
+
+	/* poll() still reports every queued message */
+	for (i = 0; i < 3; i++) {
+		ret = poll(&fd, 1, 0);
+		ASSERT_RETURN(ret == 1 && (fd.revents & POLLIN));
+
+		ret = kdbus_msg_recv(a, NULL, NULL);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	ret = kdbus_msg_recv(a, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	ret = poll(&fd, 1, 0);
+	ASSERT_RETURN(ret == 0);
+
+	/* the drained queue wakes up on the next message */
+	cnt = kdbus_fill_conn_queue(b, a->id, 1);
+	ASSERT_RETURN(cnt == 1);
+
+	ret = poll(&fd, 1, 100);
+	ASSERT_RETURN(ret == 1 && (fd.revents & POLLIN));
+
+	kdbus_conn_free(a);
+	kdbus_conn_free(b);
+
+	/* every message wakes up a receiver that does not coalesce */
+	ret = kdbus_count_queue_wakeups(env, 0, 3);
+	ASSERT_RETURN(ret == 3);
+
+	/* only the first message wakes up a coalescing receiver */
+	ret = kdbus_count_queue_wakeups(env, KDBUS_HELLO_COALESCE_WAKEUP, 3);
+	ASSERT_RETURN(ret == 0);
+
+	return TEST_OK;
+}
+
+static int kdbus_test_fair_queue(struct kdbus_test_env *env)
+{
+	struct kdbus_conn *holder, *a, *b;
+	struct kdbus_msg *msg;
+	struct kdbus_policy_access access = {
+		.type = KDBUS_POLICY_ACCESS_WORLD,
+		.id = getuid(),
+		.access = KDBUS_POLICY_TALK,
+	};
+	unsigned int i, cnt;
+	int ret;
+
+	holder = kdbus_hello_registrar(env->buspath, "com.example.a",
+				       &access, 1,
+				       KDBUS_HELLO_POLICY_HOLDER);
+	ASSERT_RETURN(holder);
+
+	a = kdbus_hello(env->buspath, KDBUS_HELLO_FAIR_QUEUE, NULL, 0);
+	ASSERT_RETURN(a);
+
+	b = kdbus_hello(env->buspath, 0, NULL, 0);
+	ASSERT_RETURN(b);
+
+	ret = kdbus_name_acquire(a, "com.example.a", NULL);
+	ASSERT_RETURN(ret >= 0);
+
+	cnt = kdbus_fill_conn_queue(b, a->id, 3);
+	ASSERT_RETURN(cnt == 3);
+
+	ret = RUN_UNPRIVILEGED_CONN(unpriv, env->buspath, ({
+		cnt = kdbus_fill_conn_queue(unpriv, a->id, 3);
+		ASSERT_EXIT(cnt == 3);
+	}));
+	ASSERT_RETURN(ret == 0);
+
+	/* both users take turns, although b queued all its messages first */
+	for (i = 0; i < 6; i++) {
+		ret = kdbus_msg_recv(a, &msg, NULL);
+		ASSERT_RETURN(ret == 0);
+
+		ASSERT_RETURN((msg->src_id == b->id) == (i % 2 == 0));
+
+		kdbus_msg_free(msg);
+	}
+
+	ret = kdbus_msg_recv(a, NULL, NULL);
+	ASSERT_RETURN(ret == -EAGAIN);
+
+	kdbus_conn_free(holder);
+	kdbus_conn_free(a);
+	kdbus_conn_free(b);
+
+	return TEST_OK;
+}
+
 static int kdbus_test_broadcast_quota(struct kdbus_test_env *env)
 {
 	int ret;
@@ -619,6 +950,15 @@ int kdbus_test_message_quota(struct kdbus_test_env *env)
 	ret = kdbus_test_expected_reply_quota(env);
 	ASSERT_RETURN(ret == 0);
 
+	ret = kdbus_test_queue_depth(env);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_test_pollout(env);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_test_coalesce_wakeup(env);
+	ASSERT_RETURN(ret == 0);
+
 	if (geteuid() == 0 && all_uids_gids_are_mapped()) {
 		ret = kdbus_test_multi_users_quota(env);
 		ASSERT_RETURN(ret == 0);
@@ -626,6 +966,9 @@ int kdbus_test_message_quota(struct kdbus_test_env *env)
 		ret = kdbus_test_broadcast_quota(env);
 		ASSERT_RETURN(ret == 0);
 
+		ret = kdbus_test_fair_queue(env);
+		ASSERT_RETURN(ret == 0);
+
 		/* Drop to 'nobody' and continue test */
 		ret = setresuid(UNPRIV_UID, UNPRIV_UID, UNPRIV_UID);
 		ASSERT_RETURN(ret == 0);
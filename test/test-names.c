@@ -182,3 +182,187 @@ int kdbus_test_name_queue(struct kdbus_test_env *env)
 
 	return TEST_OK;
 }
+
+/*
+ * Issue KDBUS_CMD_NAME_LIST with the optional cursor and generation items,
+ * which are updated with the values returned by the kernel.
+ */
+static int name_list(struct kdbus_conn *conn, uint64_t flags,
+		     struct kdbus_name_list_cursor *cursor,
+		     uint64_t *generation, uint64_t *offset)
+{
+	uint64_t buf[(sizeof(struct kdbus_cmd_name_list) +
+		      KDBUS_ITEM_SIZE(sizeof(*cursor)) +
+		      KDBUS_ITEM_SIZE(sizeof(*generation))) / 8];
+	struct kdbus_cmd_name_list *cmd_list = (void *)buf;
+	struct kdbus_item *item, *cursor_item = NULL, *generation_item = NULL;
+	int ret;
+
+	memset(buf, 0, sizeof(buf));
+	cmd_list->flags = flags;
+
+	item = cmd_list->items;
+
+	if (cursor) {
+		item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(*cursor);
+		item->type = KDBUS_ITEM_NAME_LIST_CURSOR;
+		item->name_list_cursor = *cursor;
+		cursor_item = item;
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
+	if (generation) {
+		item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(*generation);
+		item->type = KDBUS_ITEM_NAME_LIST_GENERATION;
+		item->data64[0] = *generation;
+		generation_item = item;
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
+	cmd_list->size = (uint8_t *)item - (uint8_t *)cmd_list;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_NAME_LIST, cmd_list);
+	if (ret < 0)
+		return -errno;
+
+	if (cursor)
+		*cursor = cursor_item->name_list_cursor;
+	if (generation)
+		*generation = generation_item->data64[0];
+
+	*offset = cmd_list->offset;
+
+	return 0;
+}
+
+int kdbus_test_name_list(struct kdbus_test_env *env)
+{
+	struct kdbus_name_list_cursor cursor = {};
+	struct kdbus_conn *conns[80];
+	struct kdbus_name_list *list;
+	struct kdbus_name_info *name;
+	uint64_t generation, g, offset;
+	unsigned int i, n, pages, found;
+	int ret;
+
+	ret = kdbus_name_acquire(env->conn, "foo.bla.blaz", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	generation = 0;
+	ret = name_list(env->conn, KDBUS_NAME_LIST_UNIQUE, NULL,
+			&generation, &offset);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_free(env->conn, offset);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_acquire(env->conn, "foo.bla.blub", NULL);
+	ASSERT_RETURN(ret == 0);
+
+	ret = kdbus_name_release(env->conn, "foo.bla.blaz");
+	ASSERT_RETURN(ret == 0);
+
+	/* the two changes since the first name was acquired, in order */
+	g = generation;
+	ret = name_list(env->conn, KDBUS_NAME_LIST_CHANGES, NULL, &g, &offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(g == generation + 2);
+
+	n = 0;
+	list = (struct kdbus_name_list *)(env->conn->buf + offset);
+	KDBUS_ITEM_FOREACH(name, list, names) {
+		struct kdbus_item *item;
+		const char *s = NULL;
+
+		KDBUS_ITEM_FOREACH(item, name, items)
+			if (item->type == KDBUS_ITEM_OWNED_NAME)
+				s = item->name.name;
+
+		ASSERT_RETURN(s != NULL);
+
+		if (n == 0) {
+			ASSERT_RETURN(strcmp(s, "foo.bla.blub") == 0);
+			ASSERT_RETURN(name->owner_id == env->conn->id);
+		} else {
+			ASSERT_RETURN(strcmp(s, "foo.bla.blaz") == 0);
+			ASSERT_RETURN(name->owner_id == 0);
+		}
+
+		n++;
+	}
+
+	ASSERT_RETURN(n == 2);
+
+	ret = kdbus_free(env->conn, offset);
+	ASSERT_RETURN(ret == 0);
+
+	/* a generation that was not reached yet */
+	g = generation + 3;
+	ret = name_list(env->conn, KDBUS_NAME_LIST_CHANGES, NULL, &g, &offset);
+	ASSERT_RETURN(ret == -EINVAL);
+
+	/* the generation is mandatory for incremental listings */
+	ret = name_list(env->conn, KDBUS_NAME_LIST_CHANGES, NULL, NULL,
+			&offset);
+	ASSERT_RETURN(ret == -EINVAL);
+
+	/* paged and incremental listing cannot be combined */
+	g = generation;
+	ret = name_list(env->conn,
+			KDBUS_NAME_LIST_CHANGES | KDBUS_NAME_LIST_PAGED,
+			&cursor, &g, &offset);
+	ASSERT_RETURN(ret == -EINVAL);
+
+	/* the cursor is mandatory for paged listings */
+	ret = name_list(env->conn,
+			KDBUS_NAME_LIST_UNIQUE | KDBUS_NAME_LIST_PAGED,
+			NULL, NULL, &offset);
+	ASSERT_RETURN(ret == -EINVAL);
+
+	/* enough connections to span several pages */
+	for (i = 0; i < ELEMENTSOF(conns); i++) {
+		conns[i] = kdbus_hello(env->buspath, 0, NULL, 0);
+		ASSERT_RETURN(conns[i]);
+	}
+
+	/* walk all pages, every connection must show up exactly once */
+	found = 0;
+	pages = 0;
+	memset(&cursor, 0, sizeof(cursor));
+
+	do {
+		ret = name_list(env->conn,
+				KDBUS_NAME_LIST_UNIQUE | KDBUS_NAME_LIST_PAGED,
+				&cursor, NULL, &offset);
+		ASSERT_RETURN(ret == 0);
+
+		n = 0;
+		list = (struct kdbus_name_list *)(env->conn->buf + offset);
+		KDBUS_ITEM_FOREACH(name, list, names) {
+			if (name->owner_id == env->conn->id)
+				found++;
+
+			for (i = 0; i < ELEMENTSOF(conns); i++)
+				if (name->owner_id == conns[i]->id)
+					found++;
+
+			n++;
+		}
+
+		/* every connection yields a single record here */
+		ASSERT_RETURN(n <= 64);
+
+		ret = kdbus_free(env->conn, offset);
+		ASSERT_RETURN(ret == 0);
+
+		pages++;
+	} while (cursor.bucket != 0 || cursor.id != 0);
+
+	ASSERT_RETURN(found == ELEMENTSOF(conns) + 1);
+	ASSERT_RETURN(pages > 1);
+
+	for (i = 0; i < ELEMENTSOF(conns); i++)
+		kdbus_conn_free(conns[i]);
+
+	return TEST_OK;
+}
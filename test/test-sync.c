@@ -222,6 +222,88 @@ static int no_cancel_sync(struct kdbus_conn *conn_src,
 	return (status == EXIT_SUCCESS) ? 0 : -1;
 }
 
+static int send_busy_poll_sync(struct kdbus_conn *conn_src,
+			       uint64_t dst_id, uint64_t busy_poll_ns,
+			       uint64_t item_size)
+{
+	struct {
+		struct kdbus_cmd_send cmd;
+		uint64_t busy_poll[KDBUS_ITEM_SIZE(sizeof(uint64_t)) / 8];
+	} send;
+	struct kdbus_msg msg;
+	struct timespec now;
+	int ret;
+
+	ret = clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	ASSERT_RETURN_VAL(ret == 0, -errno);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.size = sizeof(msg);
+	msg.flags = KDBUS_MSG_EXPECT_REPLY;
+	msg.dst_id = dst_id;
+	msg.src_id = conn_src->id;
+	msg.cookie = cookie;
+	msg.payload_type = KDBUS_PAYLOAD_DBUS;
+	msg.timeout_ns = now.tv_sec * 1000000000ULL + now.tv_nsec +
+			 100000000ULL;
+
+	memset(&send, 0, sizeof(send));
+	send.cmd.size = sizeof(send);
+	send.cmd.flags = KDBUS_SEND_SYNC_REPLY;
+	send.cmd.msg_address = (uintptr_t)&msg;
+	send.cmd.items[0].type = KDBUS_ITEM_BUSY_POLL;
+	send.cmd.items[0].size = item_size;
+	send.cmd.items[0].data64[0] = busy_poll_ns;
+
+	ret = ioctl(conn_src->fd, KDBUS_CMD_SEND, &send);
+	if (ret < 0)
+		return -errno;
+
+	return kdbus_free(conn_src, send.cmd.reply.offset);
+}
+
+static int busy_poll_sync(struct kdbus_conn *conn_src,
+			  struct kdbus_conn *conn_dst)
+{
+	pid_t pid;
+	int ret, status;
+	struct kdbus_msg *msg = NULL;
+
+	/* the busy-poll time is a single 64bit value */
+	ret = send_busy_poll_sync(conn_dst, conn_src->id, 10000ULL,
+				  KDBUS_ITEM_HEADER_SIZE + sizeof(uint32_t));
+	ASSERT_RETURN(ret == -EINVAL);
+
+	cookie++;
+	pid = fork();
+	ASSERT_RETURN_VAL(pid >= 0, pid);
+
+	if (pid == 0) {
+		/* values above the limit are capped by the kernel */
+		ret = send_busy_poll_sync(conn_dst, conn_src->id, ~0ULL,
+					  KDBUS_ITEM_SIZE(sizeof(uint64_t)));
+		ASSERT_EXIT(ret == 0);
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	ret = kdbus_msg_recv_poll(conn_src, 100, &msg, NULL);
+	ASSERT_RETURN_VAL(ret == 0 && msg->cookie == cookie, -1);
+
+	kdbus_msg_free(msg);
+
+	ret = kdbus_msg_send_reply(conn_src, cookie, conn_dst->id);
+	ASSERT_RETURN_VAL(ret >= 0, ret);
+
+	ret = waitpid(pid, &status, 0);
+	ASSERT_RETURN_VAL(ret >= 0, ret);
+
+	if (WIFSIGNALED(status))
+		return -1;
+
+	return (status == EXIT_SUCCESS) ? 0 : -1;
+}
+
 static void *run_thread_reply(void *data)
 {
 	int ret;
@@ -283,6 +365,9 @@ int kdbus_test_sync_reply(struct kdbus_test_env *env)
 	ret = no_cancel_sync(conn_a, conn_b);
 	ASSERT_RETURN(ret == 0);
 
+	ret = busy_poll_sync(conn_a, conn_b);
+	ASSERT_RETURN(ret == 0);
+
 	kdbus_printf("-- closing bus connections\n");
 
 	kdbus_conn_free(conn_a);
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2013-2014 Kay Sievers
+ * Copyright (C) 2013-2014 Greg Kroah-Hartman <gregkh@linuxfoundation.org>
+ * Copyright (C) 2013-2014 Daniel Mack <daniel@zonque.org>
+ * Copyright (C) 2013-2014 David Herrmann <dh.herrmann@gmail.com>
+ * Copyright (C) 2013-2014 Linux Foundation
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM kdbus
+
+#if !defined(__KDBUS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __KDBUS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * kdbus_meta_collect - process metadata was collected for a message
+ * @bus:	Name of the bus, or "" if not collected on behalf of a bus
+ * @attach:	The KDBUS_ATTACH_* flag that was collected
+ * @ns:		Time spent collecting, in nanoseconds
+ * @bytes:	Number of bytes of metadata retained
+ */
+TRACE_EVENT(kdbus_meta_collect,
+	TP_PROTO(const char *bus, u64 attach, u64 ns, u64 bytes),
+	TP_ARGS(bus, attach, ns, bytes),
+	TP_STRUCT__entry(
+		__string(bus, bus)
+		__field(u64, attach)
+		__field(u64, ns)
+		__field(u64, bytes)
+	),
+	TP_fast_assign(
+		__assign_str(bus, bus);
+		__entry->attach = attach;
+		__entry->ns = ns;
+		__entry->bytes = bytes;
+	),
+	TP_printk("bus=%s attach=0x%llx ns=%llu bytes=%llu",
+		  __get_str(bus), __entry->attach, __entry->ns, __entry->bytes)
+);
+
+/*
+ * kdbus_meta_export - metadata was serialized into items for a receiver
+ * @bus:	Name of the bus, or "" if not exported on behalf of a bus
+ * @mask:	The KDBUS_ATTACH_* mask that was requested
+ * @ns:		Time spent serializing, in nanoseconds
+ * @bytes:	Size of the items buffer
+ */
+TRACE_EVENT(kdbus_meta_export,
+	TP_PROTO(const char *bus, u64 mask, u64 ns, u64 bytes),
+	TP_ARGS(bus, mask, ns, bytes),
+	TP_STRUCT__entry(
+		__string(bus, bus)
+		__field(u64, mask)
+		__field(u64, ns)
+		__field(u64, bytes)
+	),
+	TP_fast_assign(
+		__assign_str(bus, bus);
+		__entry->mask = mask;
+		__entry->ns = ns;
+		__entry->bytes = bytes;
+	),
+	TP_printk("bus=%s mask=0x%llx ns=%llu bytes=%llu",
+		  __get_str(bus), __entry->mask, __entry->ns, __entry->bytes)
+);
+
+#endif /* __KDBUS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>